@@ -0,0 +1,1876 @@
+/*
+ * bench.c - microbenchmarks and scenarios for jautolock (make bench)
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <malloc.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "cgroup.h"
+#include "control.h"
+#include "daemon.h"
+#include "die.h"
+#include "idle.h"
+#include "inhibit.h"
+#include "loop.h"
+#include "messages.h"
+#include "output.h"
+#include "power.h"
+#include "priority.h"
+#include "reexec.h"
+#include "tasks.h"
+#include "timecalc.h"
+#include "timespec.h"
+#include "userconfig.h"
+#include "watchdog.h"
+
+static void bench_parse_time(void);
+static void bench_parse_clock(void);
+static void bench_inhibit(void);
+static time_t utc(int mon, int mday, int hour, int min);
+static void bench_timespec(void);
+static void bench_timecalc_cycle(unsigned n);
+static void bench_handle_messages(const char *message);
+static void bench_execute_task(void);
+static void bench_deadline_output(bool prewarm);
+static void bench_output_drain(const char *log_file);
+static void bench_cgroup(void);
+static void write_text(const char *dir, const char *file, const char *value);
+static bool has_text(const char *dir, const char *file, const char *value);
+static void scenario_now(void);
+static int run_footprint(void);
+static int run_restored(const char *dir);
+static void watch_locker(struct Daemon *daemon, struct timespec *timeout);
+static int run_activated(char *dir);
+static void wait_answer(struct Daemon *daemon, struct timespec *timeout);
+static void run_scenarios(enum LoopBackend backend);
+static void open_control(char *dir);
+static void close_control(const char *dir);
+static void run_daemon(struct Task *tasks, unsigned n,
+        void (*cycled)(struct Daemon *daemon, struct timespec *timeout));
+static void scenario_throughput(const char *loop);
+static uint64_t scenario_lateness(const char *loop, bool flood);
+static void scenario_silent_client(const char *loop);
+static void scenario_control_stop(void);
+static void scenario_killed_prewarm(void);
+static void kill_prewarmed(struct Daemon *daemon, struct timespec *timeout);
+static void scenario_poll_backoff(void);
+static void poll_backing_off(struct Daemon *daemon, struct timespec *timeout);
+static void scenario_power(void);
+static void unplug_ac(struct Daemon *daemon, struct timespec *timeout);
+static void wait_ac(struct Daemon *daemon, struct timespec *timeout);
+static void write_supply(const char *dir, const char *supply,
+        const char *attr, const char *value);
+static void scenario_reexec(void);
+static void request_reexec(struct Daemon *daemon, struct timespec *timeout);
+static void reexec_client(const char *dir);
+static struct Task *make_locker(const char *dir);
+static void make_supplies(const char *dir, bool on_ac);
+static void remove_supplies(const char *dir);
+static void scenario_activated(void);
+static void scenario_watchdog(struct timespec budget);
+static void run_load(bool low_latency);
+static pid_t start_burner(bool pressure);
+static bool threads_alike(void);
+static void read_sched(const char *path, long *sched);
+static void measure_lateness(struct Task *tasks, unsigned n, bool client,
+        uint64_t *lateness);
+static void time_fired(struct Daemon *daemon, struct timespec *timeout);
+static void wait_scenarios(pid_t pid);
+static pthread_t start_client(unsigned long count);
+static void *client_main(void *arg);
+static bool send_one(const char *message);
+static struct Task *make_tasks(unsigned n, struct timespec first,
+        struct timespec interval);
+static uint64_t report_percentiles(uint64_t *samples, unsigned n,
+        unsigned percentile);
+static void check(bool ok, const char *what);
+static int compare_u64(const void *lhs, const void *rhs);
+
+// the fake idle source: the user was last active at this time
+static struct timespec last_input;
+// the scratch control socket of the scenarios, see open_control()
+static struct sockaddr_un address;
+static int connfd = -1, sigfd = -1;
+// a client thread sends messages until client_stop is set,
+// then asks the main loop to exit
+static atomic_bool client_stop;
+static atomic_ulong client_sent;
+static const char *client_message = "unbusy";
+// defeats optimizing the measured work away
+static volatile uint64_t sink;
+// messages sent right after "reexec", see reexec_client()
+static const unsigned reexec_burst = 32;
+// memory of the daemon without X after startup, see README.md
+static const long rss_budget = 4096, dirty_budget = 1024;
+
+// what the scenarios see from the main loop (see struct Daemon),
+// for measure_lateness()
+static struct {
+    uint64_t start;
+    uint64_t *lateness;
+    bool *measured;
+    unsigned fired;
+    bool client;
+} timing;
+// for scenario_killed_prewarm()
+static struct {
+    bool reaped;
+    pid_t warm;
+    bool forgotten;
+    bool rewarmed;
+    pid_t fired;
+    uint64_t start;
+    uint64_t late;
+} killed;
+// for scenario_poll_backoff()
+static struct {
+    uint64_t start;
+    unsigned long long made;
+    uint64_t sampled;
+    uint64_t gaps[16];
+    unsigned n_gap;
+    bool active;
+    uint64_t noticed;
+    uint64_t fired;
+} backoff;
+// for scenario_power()
+static struct {
+    const char *dir;
+    uint64_t start;
+    uint64_t fired[3];
+    bool unplugged;
+} ac;
+// for run_restored()
+static struct {
+    pid_t locker;
+    bool second;
+    uint64_t deadline;
+    uint64_t end;
+    uint64_t charged;
+} restored;
+// for run_activated()
+static struct {
+    int fd;
+    uint64_t start;
+    ssize_t answered;
+    uint64_t latency;
+} activated;
+
+struct timespec get_idle_time(void) {
+    struct timespec cur;
+    clock_gettime(CLOCK_MONOTONIC, &cur);
+    return timespec_sub(cur, last_input);
+}
+
+int main(int argc, char **argv) {
+    // results show up as they are measured
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if(argc > 1 && strcmp(argv[1], "--footprint") == 0)
+        return run_footprint();
+    if(argc > 2 && strcmp(argv[1], "--restored") == 0)
+        return run_restored(argv[2]);
+    if(argc > 2 && strcmp(argv[1], "--activated") == 0)
+        return run_activated(argv[2]);
+
+    // the trace of a failed check (see die.h) is written here,
+    // not over the one of a jautolock in use
+    char runtime[] = "/tmp/jautolock-bench.XXXXXX";
+    if(!mkdtemp(runtime))
+        die_perror("mkdtemp");
+    setenv("XDG_RUNTIME_DIR", runtime, 1);
+
+    bench_parse_time();
+    bench_parse_clock();
+    bench_inhibit();
+    bench_timespec();
+    for(unsigned n = 1; n <= 1000; n *= 10)
+        bench_timecalc_cycle(n);
+    bench_handle_messages("unbusy");
+    bench_handle_messages("busy 1h30m");
+    bench_handle_messages("nonsense");
+    bench_execute_task();
+    bench_deadline_output(false);
+    bench_deadline_output(true);
+    bench_output_drain(NULL);
+    bench_output_drain("/dev/null");
+    bench_cgroup();
+    scenario_now();
+    {
+        // SIGCHLD is blocked there, and power.c and the watchdog
+        // are set up once
+        fflush(stdout);
+        pid_t pid = fork();
+        if(pid < 0)
+            die_perror("fork");
+        if(pid == 0) {
+            loop_init(LOOP_SELECT);
+            scenario_control_stop();
+            scenario_killed_prewarm();
+            scenario_poll_backoff();
+            scenario_power();
+            scenario_watchdog((struct timespec) {0, 50000000});
+            exit(EXIT_SUCCESS);
+        }
+        wait_scenarios(pid);
+    }
+    {
+        // the watchdog again, without a budget
+        fflush(stdout);
+        pid_t pid = fork();
+        if(pid < 0)
+            die_perror("fork");
+        if(pid == 0) {
+            scenario_watchdog((struct timespec) {0, 0});
+            exit(EXIT_SUCCESS);
+        }
+        wait_scenarios(pid);
+    }
+    {
+        // the child turns into another instance, see run_restored()
+        fflush(stdout);
+        pid_t pid = fork();
+        if(pid < 0)
+            die_perror("fork");
+        if(pid == 0)
+            scenario_reexec();
+        wait_scenarios(pid);
+    }
+    {
+        // and this one into an activated instance, see run_activated()
+        fflush(stdout);
+        pid_t pid = fork();
+        if(pid < 0)
+            die_perror("fork");
+        if(pid == 0)
+            scenario_activated();
+        wait_scenarios(pid);
+    }
+
+    // each backend gets a fresh process, as the loop is set up once
+    enum LoopBackend backends[] = {LOOP_SELECT, LOOP_URING};
+    for(unsigned i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if(pid < 0)
+            die_perror("fork");
+        if(pid == 0) {
+            run_scenarios(backends[i]);
+            exit(EXIT_SUCCESS);
+        }
+        wait_scenarios(pid);
+    }
+    // and so do the load tests, as the settings can't be undone
+    for(int low_latency = 0; low_latency <= 1; low_latency++) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if(pid < 0)
+            die_perror("fork");
+        if(pid == 0) {
+            run_load(low_latency);
+            exit(EXIT_SUCCESS);
+        }
+        wait_scenarios(pid);
+    }
+    // a new program, so nothing from the benchmarks above is counted
+    pid_t pid = fork();
+    if(pid < 0)
+        die_perror("fork");
+    if(pid == 0) {
+        execl("/proc/self/exe", argv[0], "--footprint", (char *) NULL);
+        die_perror("execl");
+    }
+    wait_scenarios(pid);
+    rmdir(runtime);
+    return 0;
+}
+
+/**
+ * Memory of a process set up like the daemon (but without X),
+ * after it has run for a while: the resident set, and the private
+ * dirty pages that can't be shared or dropped.
+ */
+static int run_footprint(void) {
+    // as in jautolock.c
+    mallopt(M_ARENA_MAX, 1);
+    char dir[] = "/tmp/jautolock-bench.XXXXXX";
+    open_control(dir);
+    loop_init(LOOP_SELECT);
+    watchdog_start((struct timespec) {1, 0});
+
+    const unsigned n = 10;
+    struct Task *tasks = make_tasks(n, (struct timespec) {3600, 0},
+            (struct timespec) {60, 0});
+    timecalc_init();
+    clock_gettime(CLOCK_MONOTONIC, &last_input);
+    client_message = "stats";
+    pthread_t client = start_client(1000);
+    run_daemon(tasks, n, NULL);
+    pthread_join(client, NULL);
+
+    long rss = read_proc_kb("/proc/self/status", "VmRSS:");
+    long dirty = read_proc_kb("/proc/self/smaps_rollup", "Private_Dirty:");
+    printf("{\"scenario\": \"footprint\", \"rss_kib\": %ld, "
+            "\"private_dirty_kib\": %ld, \"rss_budget_kib\": %ld, "
+            "\"private_dirty_budget_kib\": %ld}\n",
+            rss, dirty, rss_budget, dirty_budget);
+    check(rss >= 0 && rss <= rss_budget, "the resident set is within budget");
+    check(dirty >= 0 && dirty <= dirty_budget,
+            "private dirty memory is within budget");
+
+    close_control(dir);
+    free(tasks);
+    return 0;
+}
+
+/**
+ * The second half of scenario_reexec(), in the new image:
+ * keep track of the running locker, and its log, until it exits.
+ */
+static int run_restored(const char *dir) {
+    struct Task *tasks = make_locker(dir), *task = tasks;
+    timecalc_init();
+    bool own_socket;
+    check(reexec_restore(&connfd, &own_socket, &sigfd, tasks, 2),
+            "the state is passed on reexec");
+    restored.locker = task->pid;
+    check(restored.locker > 0 && task->outfd >= 0 && task->logfd >= 0,
+            "a running locker and its output are passed on reexec");
+    check(!tasks[1].disabled && timespec_ns(tasks[1].enabled_at) > 0 &&
+            tasks[1].pid == 0, "when a task was enabled is passed on reexec");
+    // where the task for AC is due, as in jautolock.c
+    struct TimecalcState state;
+    timecalc_get_state(&state);
+    uint64_t due = timespec_ns(timespec_add(state.offset,
+                timespec_add(tasks[1].enabled_at, tasks[1].time)));
+    char power[64];
+    snprintf(power, sizeof(power), "%s/power", dir);
+    power_init(power, tasks, 2);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s/socket", dir);
+    loop_init(LOOP_SELECT);
+    restored.deadline = now_ns() + 5000000000;
+    run_daemon(tasks, 2, watch_locker);
+    check(!restored.second, "no second locker is fired after reexec");
+    check(restored.end != 0, "the locker is reaped after reexec");
+    printf("{\"scenario\": \"reexec_power\", \"fired\": %s, "
+            "\"late_ms\": %.1f}\n", restored.charged ? "true" : "false",
+            ((double) restored.charged - due) / 1e6);
+    check(restored.charged >= due,
+            "a task enabled before reexec is timed from when it was");
+    check(restored.charged != 0, "a task enabled before reexec is fired");
+
+    char line[64] = "";
+    FILE *f = fopen(task->log_file, "re");
+    if(!f || !fgets(line, sizeof(line), f))
+        die_perror("read log");
+    fclose(f);
+    printf("{\"scenario\": \"reexec\", \"locker_kept\": true, "
+            "\"logged\": %s}\n", strcmp(line, "locked\n") == 0 ?
+            "true" : "false");
+    check(strcmp(line, "locked\n") == 0,
+            "output of a running locker is still logged after reexec");
+
+    // the client may still be reading the last responses
+    char path[64];
+    snprintf(path, sizeof(path), "%s/answered", dir);
+    long answered = -1;
+    for(int tries = 0; tries < 200 && answered < 0; tries++) {
+        if((f = fopen(path, "re"))) {
+            if(fscanf(f, "%ld", &answered) != 1)
+                answered = -1;
+            fclose(f);
+        } else {
+            nanosleep(&(struct timespec) {0, 10000000}, NULL);
+        }
+    }
+    printf("{\"scenario\": \"reexec_messages\", \"sent\": %u, "
+            "\"answered\": %ld}\n", 1 + reexec_burst, answered);
+    check(answered == 1 + reexec_burst,
+            "messages sent around a reexec are all answered");
+
+    unlink(path);
+    unlink(task->log_file);
+    remove_supplies(dir);
+    close_control(dir);
+    close(sigfd);
+    free(tasks);
+    return 0;
+}
+
+// Stop a while after the locker exits (or after a few seconds).
+static void watch_locker(struct Daemon *daemon, struct timespec *timeout) {
+    const struct Task *task = daemon->tasks;
+    if(task->pid && task->pid != restored.locker)
+        restored.second = true;
+    uint64_t now = now_ns();
+    if(daemon->tasks[1].pid && !restored.charged)
+        restored.charged = now;
+    if(!task->pid && !restored.end)
+        restored.end = now + 200000000;
+    if(now >= restored.deadline ||
+            (restored.end && now >= restored.end && restored.charged))
+        daemon_stop(0);
+    timespec_minify(timeout, (struct timespec) {0, 50000000});
+}
+
+/**
+ * The second half of scenario_activated(), in the new image:
+ * send a message before taking the socket, then take it and serve it.
+ */
+static int run_activated(char *dir) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s/socket", dir);
+    activated.fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(activated.fd < 0 || connect(activated.fd,
+                (const struct sockaddr *) &address, sizeof(address)) < 0 ||
+            send(activated.fd, "unbusy", 6, MSG_EOR) < 0)
+        die_perror("send");
+
+    // only for this process
+    const char *pid = getenv("LISTEN_PID");
+    setenv("LISTEN_PID", "1", 1);
+    check(control_activated_socket() < 0,
+            "a socket passed to another process is not taken");
+    setenv("LISTEN_PID", pid, 1);
+    connfd = control_activated_socket();
+    check(connfd == 3 && fcntl(connfd, F_GETFD) == FD_CLOEXEC &&
+            !getenv("LISTEN_PID") && !getenv("LISTEN_FDS"),
+            "a socket passed by a service manager is taken");
+
+    activated.start = now_ns();
+    sigfd = daemon_signalfd();
+    loop_init(LOOP_SELECT);
+    struct Task *tasks = make_tasks(1, (struct timespec) {3600, 0},
+            (struct timespec) {1, 0});
+    timecalc_init();
+    clock_gettime(CLOCK_MONOTONIC, &last_input);
+    activated.answered = -1;
+    run_daemon(tasks, 1, wait_answer);
+    printf("{\"scenario\": \"activated\", \"answered\": %s, "
+            "\"latency_us\": %.1f}\n",
+            activated.answered > 0 ? "true" : "false",
+            activated.latency / 1e3);
+    check(activated.answered > 0,
+            "a message sent before jautolock is up is answered");
+
+    close(activated.fd);
+    close_control(dir);
+    free(tasks);
+    return 0;
+}
+
+// Stop once the message sent early is answered (or after a second).
+static void wait_answer(struct Daemon *daemon, struct timespec *timeout) {
+    (void) daemon;
+    char response[256];
+    if(activated.answered <= 0)
+        activated.answered = recv(activated.fd, response, sizeof(response),
+                MSG_DONTWAIT);
+    activated.latency = now_ns() - activated.start;
+    if(activated.answered > 0 || activated.latency >= 1000000000)
+        daemon_stop(0);
+    timespec_minify(timeout, (struct timespec) {0, 10000000});
+}
+
+static void bench_parse_time(void) {
+    const unsigned long ops = 1000000;
+    uint64_t start = now_ns();
+    for(unsigned long i = 0; i < ops; i++) {
+        struct timespec t;
+        parse_time("1h30m15s500ms", &t);
+        sink += t.tv_nsec;
+    }
+    printf("{\"bench\": \"parse_time\", \"ops\": %lu, \"ns_per_op\": %.1f}\n",
+            ops, (double) (now_ns() - start) / ops);
+}
+
+static void bench_parse_clock(void) {
+    const char *good[] = {"0:00", "9:30", "09:30", "23:59:59", "24:00"};
+    const char *bad[] = {"12:5", "12:05:1", "+1:00", "-1:00", " 1:00",
+        "1: 00", "123:00", "12:60", "24:00:01", "12", "12:00:00:00", ""};
+    for(unsigned i = 0; i < sizeof(good) / sizeof(*good); i++) {
+        int sec;
+        check(parse_clock(good[i], &sec) == 0, "a time of day is accepted");
+    }
+    for(unsigned i = 0; i < sizeof(bad) / sizeof(*bad); i++) {
+        int sec;
+        check(parse_clock(bad[i], &sec) < 0,
+                "a malformed time of day is rejected");
+    }
+    unsigned days;
+    check(parse_days("fri-mon", &days) == 0 && days == 0x63,
+            "a range of weekdays wraps around the week");
+    check(parse_days("mon-wed,sat", &days) == 0 && days == 0x4e,
+            "ranges of weekdays add up");
+    check(parse_days("mon-", &days) < 0 && parse_days("monday", &days) < 0 &&
+            parse_days("mon,", &days) < 0, "malformed weekdays are rejected");
+
+    const unsigned long ops = 1000000;
+    uint64_t start = now_ns();
+    for(unsigned long i = 0; i < ops; i++) {
+        int sec;
+        parse_clock("12:34:56", &sec);
+        sink += sec;
+    }
+    printf("{\"bench\": \"parse_clock\", \"ops\": %lu, \"ns_per_op\": %.1f}\n",
+            ops, (double) (now_ns() - start) / ops);
+}
+
+// windows over midnight, weekdays and switches of daylight saving time
+static void bench_inhibit(void) {
+    // Central European Time, whatever the tz database installed
+    char *tz = getenv("TZ") ? strdup(getenv("TZ")) : NULL;
+    setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+    tzset();
+    time_t edge;
+
+    // 2024-01-05 is a Friday; from 22:00 to 06:00 on Fridays
+    struct Inhibit night = {1u << 5, 22 * 3600, 6 * 3600};
+    check(inhibit_active(&night, 1, utc(1, 5, 22, 0), &edge) &&
+            edge == utc(1, 6, 5, 0) &&
+            inhibit_active(&night, 1, utc(1, 6, 2, 0), &edge) &&
+            edge == utc(1, 6, 5, 0),
+            "a window over midnight lasts until the next morning");
+    check(!inhibit_active(&night, 1, utc(1, 6, 6, 0), &edge) &&
+            edge == utc(1, 12, 21, 0) &&
+            !inhibit_active(&night, 1, utc(1, 6, 22, 0), &edge),
+            "a window over midnight starts on its own weekdays only");
+    // from 09:00 to 17:00 on weekdays, looked at on Saturday
+    struct Inhibit office = {0x3e, 9 * 3600, 17 * 3600};
+    check(!inhibit_active(&office, 1, utc(1, 6, 9, 0), &edge) &&
+            edge == utc(1, 8, 8, 0),
+            "a range of weekdays skips the weekend");
+
+    // clocks go from 02:00 to 03:00 on 2024-03-31,
+    // and from 03:00 back to 02:00 on 2024-10-27
+    struct Inhibit early = {0x7f, 1 * 3600, 5 * 3600};
+    check(inhibit_active(&early, 1, utc(3, 31, 0, 30), &edge) &&
+            edge == utc(3, 31, 3, 0) &&
+            inhibit_active(&early, 1, utc(3, 31, 2, 30), &edge) &&
+            edge == utc(3, 31, 3, 0),
+            "a window ends by the clock when it is put forward");
+    check(inhibit_active(&early, 1, utc(10, 26, 23, 30), &edge) &&
+            edge == utc(10, 27, 4, 0) &&
+            inhibit_active(&early, 1, utc(10, 27, 1, 30), &edge) &&
+            edge == utc(10, 27, 4, 0),
+            "a window ends by the clock when it is put back");
+    struct Inhibit skipped = {0x7f, 2 * 3600 + 1800, 4 * 3600};
+    check(inhibit_active(&skipped, 1, utc(3, 31, 1, 50), &edge) &&
+            edge == utc(3, 31, 2, 0),
+            "a window starting at a skipped time still takes effect");
+
+    if(tz)
+        setenv("TZ", tz, 1);
+    else
+        unsetenv("TZ");
+    free(tz);
+    tzset();
+
+    struct Inhibit windows[] = {night, office, early};
+    const unsigned long ops = 10000;
+    time_t now = time(NULL);
+    uint64_t start = now_ns();
+    for(unsigned long i = 0; i < ops; i++)
+        sink += inhibit_active(windows, 3, now + i * 60, &edge);
+    printf("{\"bench\": \"inhibit_active\", \"windows\": 3, \"ops\": %lu, "
+            "\"ns_per_op\": %.1f}\n", ops, (double) (now_ns() - start) / ops);
+}
+
+// 2024-mon-mday hour:min in UTC
+static time_t utc(int mon, int mday, int hour, int min) {
+    struct tm tm = {
+        .tm_year = 2024 - 1900,
+        .tm_mon = mon - 1,
+        .tm_mday = mday,
+        .tm_hour = hour,
+        .tm_min = min,
+    };
+    return timegm(&tm);
+}
+
+// a mix of what timecalc_cycle does per task
+static void bench_timespec(void) {
+    const unsigned long ops = 10000000;
+    struct timespec acc = {0, 0}, step = {0, 999999999}, min = {1L << 40, 0};
+    uint64_t start = now_ns();
+    for(unsigned long i = 0; i < ops; i++) {
+        acc = timespec_add(acc, step);
+        struct timespec d = timespec_sub(acc, step);
+        timespec_minify(&min, d);
+        sink += timespec_cmp(d, acc);
+    }
+    sink += min.tv_sec;
+    printf("{\"bench\": \"timespec\", \"ops\": %lu, \"ns_per_op\": %.2f}\n",
+            ops, (double) (now_ns() - start) / ops);
+}
+
+// cycles in which no task is due, so nothing is forked
+static void bench_timecalc_cycle(unsigned n) {
+    struct Task *tasks = make_tasks(n, (struct timespec) {3600, 0},
+            (struct timespec) {1, 0});
+    const unsigned long ops = 1000000 / n < 1000 ? 1000 : 1000000 / n;
+    timecalc_init();
+    clock_gettime(CLOCK_MONOTONIC, &last_input);
+    unsigned long long made, avoided;
+    timecalc_get_samples(&made, &avoided);
+    uint64_t start = now_ns();
+    for(unsigned long i = 0; i < ops; i++) {
+        struct timespec timeout;
+        timecalc_cycle(&timeout, tasks, n);
+        sink += timeout.tv_nsec;
+    }
+    uint64_t elapsed = now_ns() - start;
+    unsigned long long made2, avoided2;
+    timecalc_get_samples(&made2, &avoided2);
+    printf("{\"bench\": \"timecalc_cycle\", \"tasks\": %u, \"ops\": %lu, "
+            "\"ns_per_op\": %.1f, \"idle_queries\": %llu}\n",
+            n, ops, (double) elapsed / ops, made2 - made);
+    free(tasks);
+}
+
+static void bench_handle_messages(const char *message) {
+    struct Task *tasks = make_tasks(10, (struct timespec) {3600, 0},
+            (struct timespec) {1, 0});
+    const unsigned long ops = 100000;
+    uint64_t start = now_ns();
+    for(unsigned long i = 0; i < ops; i++)
+        free(handle_messages(message, tasks, 10));
+    printf("{\"bench\": \"handle_messages\", \"message\": \"%s\", "
+            "\"ops\": %lu, \"ns_per_op\": %.1f}\n",
+            message, ops, (double) (now_ns() - start) / ops);
+    timecalc_set_busy(false);
+    free(tasks);
+}
+
+// time to return from execute_task, and until the task has exited
+static void bench_execute_task(void) {
+    struct Task *task = make_tasks(1, (struct timespec) {0, 0},
+            (struct timespec) {0, 0});
+    const unsigned ops = 200;
+    uint64_t spawn[ops], run[ops];
+    for(unsigned i = 0; i < ops; i++) {
+        uint64_t start = now_ns();
+        execute_task(task);
+        spawn[i] = now_ns() - start;
+        if(waitpid(task->pid, NULL, 0) < 0)
+            die_perror("waitpid");
+        run[i] = now_ns() - start;
+        task->pid = 0;
+    }
+    printf("{\"bench\": \"execute_task\", \"measure\": \"return\", "
+            "\"ops\": %u, ", ops);
+    report_percentiles(spawn, ops, 99);
+    printf("{\"bench\": \"execute_task\", \"measure\": \"exit\", "
+            "\"ops\": %u, ", ops);
+    report_percentiles(run, ops, 99);
+    free(task);
+}
+
+// time from the deadline until the task has written its output,
+// forked then or prewarmed in advance
+static void bench_deadline_output(bool prewarm) {
+    struct Task *task = make_tasks(1, (struct timespec) {0, 0},
+            (struct timespec) {0, 0});
+    task->command = "echo fired";
+    task->log.size = 64;
+    const unsigned ops = 100;
+    uint64_t output[ops];
+    for(unsigned i = 0; i < ops; i++) {
+        if(prewarm)
+            prewarm_task(task, (struct timespec) {i + 1, 0});
+        // time to get ready and wait, both ways alike
+        nanosleep(&(struct timespec) {0, 5000000}, NULL);
+        uint64_t start = now_ns();
+        execute_task(task);
+        struct pollfd pfd = {task->outfd, POLLIN, 0};
+        if(poll(&pfd, 1, -1) < 0)
+            die_perror("poll");
+        output[i] = now_ns() - start;
+        if(waitpid(task->pid, NULL, 0) < 0)
+            die_perror("waitpid");
+        task->pid = 0;
+    }
+    while(task->outfd >= 0)
+        output_drain(task);
+    printf("{\"bench\": \"execute_task\", \"measure\": \"output\", "
+            "\"prewarm\": %s, \"ops\": %u, ", prewarm ? "true" : "false",
+            ops);
+    report_percentiles(output, ops, 99);
+    free(task->log.data);
+    free(task);
+}
+
+/**
+ * Output taken per wakeup from a task writing non-stop,
+ * kept in its ring buffer and optionally spliced to log_file.
+ */
+static void bench_output_drain(const char *log_file) {
+    struct Task *task = make_tasks(1, (struct timespec) {0, 0},
+            (struct timespec) {0, 0});
+    task->command = "yes";
+    task->log.size = 4096;
+    task->log_file = log_file;
+    execute_task(task);
+
+    const unsigned ops = 200;
+    unsigned long long most = 0;
+    uint64_t start = now_ns();
+    for(unsigned i = 0; i < ops && task->outfd >= 0; i++) {
+        struct pollfd p = {.fd = task->outfd, .events = POLLIN};
+        poll(&p, 1, 100);
+        unsigned long long before = task->log.written;
+        output_drain(task);
+        if(task->log.written - before > most)
+            most = task->log.written - before;
+    }
+    uint64_t elapsed = now_ns() - start;
+    kill(task->pid, SIGKILL);
+    waitpid(task->pid, NULL, 0);
+    if(task->outfd >= 0)
+        close(task->outfd);
+    if(task->logfd >= 0)
+        close(task->logfd);
+    free(task->log.data);
+
+    printf("{\"bench\": \"output_drain\", \"log_file\": %s, "
+            "\"ops\": %u, \"ns_per_op\": %.1f, \"max_bytes\": %llu}\n",
+            log_file ? "true" : "false", ops, (double) elapsed / ops, most);
+    check(most <= 65536, "a wakeup takes at most 64KiB from a task");
+    free(task);
+}
+
+/**
+ * Set up the cgroups of tasks in a fake cgroup directory, "run" one
+ * by changing its counters, and see what `jautolock usage` would show
+ * and that the leaves are removed on the way out.
+ */
+static void bench_cgroup(void) {
+    char dir[] = "/tmp/jautolock-bench.XXXXXX";
+    if(!mkdtemp(dir))
+        die_perror("mkdtemp");
+    write_text(dir, "cgroup.controllers", "cpu memory\n");
+    write_text(dir, "cgroup.subtree_control", "");
+    write_text(dir, "cgroup.procs", "");
+    write_text(dir, "jautolock/cgroup.procs", "");
+    // the kernel fills in a leaf when it is created, the bench beforehand
+    write_text(dir, "task-a_b/memory.max", "");
+    write_text(dir, "task-a_b/memory.peak", "2097152\n");
+    write_text(dir, "task-a_b/cpu.stat", "user_usec 1\nusage_usec 1500000\n");
+
+    const unsigned n = 4;
+    struct Task *tasks = make_tasks(n, (struct timespec) {1, 0},
+            (struct timespec) {0, 0});
+    tasks[0].name = "a/b";
+    tasks[0].cgroup = true;
+    tasks[0].memory_max = "64M";
+    tasks[1].name = "plain";
+    tasks[2].name = "idle";
+    tasks[2].cgroup = true;
+    // memory.max can't be written, so it runs without a cgroup
+    tasks[3].name = "limited";
+    tasks[3].cgroup = true;
+    tasks[3].memory_max = "1G";
+    cgroup_init(dir, tasks, n, false);
+    check(tasks[0].cgroupfd >= 0 && tasks[1].cgroupfd < 0 &&
+            tasks[2].cgroupfd >= 0 && tasks[3].cgroupfd < 0,
+            "tasks get a cgroup if they ask for one and it can be set up");
+    check(has_text(dir, "task-a_b/memory.max", "64M") &&
+            has_text(dir, "cgroup.subtree_control", "+memory") &&
+            has_text(dir, "jautolock/cgroup.procs", "0"),
+            "jautolock moves to its leaf and sets the limits of tasks");
+
+    cgroup_prepare(tasks);
+    write_text(dir, "task-a_b/cpu.stat", "user_usec 1\nusage_usec 2750000\n");
+    const unsigned long ops = 10000;
+    uint64_t start = now_ns();
+    for(unsigned long i = 0; i < ops; i++)
+        cgroup_collect(tasks);
+    printf("{\"bench\": \"cgroup_collect\", \"ops\": %lu, "
+            "\"ns_per_op\": %.1f}\n", ops, (double) (now_ns() - start) / ops);
+    tasks[0].runs = 1;
+    char *usage = cgroup_usage(tasks, n);
+    check(strcmp(usage, "a/b: ran 1 times, the last run used 1.250 s of CPU, "
+                "at most 2048 KiB of memory\nidle: not run yet\n"
+                "limited: not in a cgroup") == 0,
+            "the usage of tasks in cgroups is shown");
+    free(usage);
+
+    // left empty, as the kernel would once the task is gone
+    const char *files[] = {"task-a_b/memory.max", "task-a_b/memory.peak",
+        "task-a_b/cpu.stat", "jautolock/cgroup.procs"};
+    for(unsigned i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        if(remove(path) < 0)
+            die_perror("remove");
+    }
+    cgroup_cleanup(tasks, n);
+    char path[64];
+    snprintf(path, sizeof(path), "%s/task-a_b", dir);
+    bool removed = access(path, F_OK) < 0;
+    snprintf(path, sizeof(path), "%s/task-idle", dir);
+    removed &= access(path, F_OK) < 0;
+    snprintf(path, sizeof(path), "%s/jautolock", dir);
+    removed &= access(path, F_OK) < 0;
+    check(removed && has_text(dir, "cgroup.subtree_control", "-memory") &&
+            has_text(dir, "cgroup.procs", "0"),
+            "the leaves are removed on the way out");
+
+    const char *left[] = {"task-limited", "cgroup.controllers",
+        "cgroup.subtree_control", "cgroup.procs", ""};
+    for(unsigned i = 0; i < sizeof(left) / sizeof(left[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, left[i]);
+        if(remove(path) < 0)
+            die_perror("remove");
+    }
+    free(tasks);
+}
+
+// Write file (and its directory if needed) in dir.
+static void write_text(const char *dir, const char *file, const char *value) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    char *slash = strrchr(path, '/');
+    if(slash - path > (ptrdiff_t) strlen(dir)) {
+        *slash = '\0';
+        if(mkdir(path, 0755) < 0 && errno != EEXIST)
+            die_perror("mkdir");
+        *slash = '/';
+    }
+    FILE *f = fopen(path, "we");
+    if(!f)
+        die_perror("fopen");
+    fputs(value, f);
+    fclose(f);
+}
+
+// Whether file in dir holds just value.
+static bool has_text(const char *dir, const char *file, const char *value) {
+    char path[64], text[64];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    FILE *f = fopen(path, "re");
+    if(!f)
+        return false;
+    size_t len = fread(text, 1, sizeof(text) - 1, f);
+    fclose(f);
+    text[len] = '\0';
+    return strcmp(text, value) == 0;
+}
+
+/**
+ * Fire a repeating locker by hand long after it was last fired
+ * on schedule, and see that the task after it is timed from then.
+ */
+static void scenario_now(void) {
+    // the locker every minute after an hour, then screenoff 30s after it
+    struct Task *tasks = make_tasks(2, (struct timespec) {3600, 0},
+            (struct timespec) {30, 0});
+    tasks[0].name = "lock";
+    tasks[0].every = (struct timespec) {60, 0};
+    tasks[0].step = (struct timespec) {4200, 0};
+    tasks[1].name = "screenoff";
+    timecalc_init();
+    clock_gettime(CLOCK_MONOTONIC, &last_input);
+    free(handle_messages("now lock", tasks, 2));
+    struct timespec timeout;
+    timecalc_cycle(&timeout, tasks, 2);
+    if(waitpid(tasks[0].pid, NULL, 0) < 0)
+        die_perror("waitpid");
+
+    printf("{\"scenario\": \"now\", \"step_s\": %lld, "
+            "\"next_s\": %.3f}\n", (long long) tasks[0].step.tv_sec,
+            timespec_ns(timeout) / 1e9);
+    check(timespec_cmp(tasks[0].step, (struct timespec) {3600, 0}) == 0 &&
+            timespec_ns(timeout) > 29000000000 &&
+            timespec_ns(timeout) <= 30000000000 && tasks[1].pid == 0,
+            "a task fired by hand is timed from its next deadline");
+    free(tasks);
+}
+
+/**
+ * Run the main loop on a scratch socket with each scenario.
+ */
+static void run_scenarios(enum LoopBackend backend) {
+    loop_init(backend);
+    unsigned long long waits, syscalls;
+    // the name of the backend actually used
+    const char *loop = loop_stats(&waits, &syscalls);
+
+    char dir[] = "/tmp/jautolock-bench.XXXXXX";
+    open_control(dir);
+
+    scenario_throughput(loop);
+    uint64_t quiet = scenario_lateness(loop, false);
+    uint64_t flooded = scenario_lateness(loop, true);
+    // the control thread takes the messages off the main loop
+    check(flooded <= quiet + 10000000,
+            "a flood of messages delays firing by at most 10ms (90%)");
+    scenario_silent_client(loop);
+
+    close_control(dir);
+}
+
+/**
+ * Block SIGCHLD as jautolock.c does, and listen on a scratch control
+ * socket in dir (a template for mkdtemp), for run_daemon().
+ */
+static void open_control(char *dir) {
+    if(sigfd < 0)
+        sigfd = daemon_signalfd();
+    if(!mkdtemp(dir))
+        die_perror("mkdtemp");
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s/socket", dir);
+    connfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(connfd < 0)
+        die_perror("socket");
+    if(bind(connfd, (const struct sockaddr *) &address, sizeof(address)) < 0)
+        die_perror("bind");
+    if(listen(connfd, 20) < 0)
+        die_perror("listen");
+}
+
+static void close_control(const char *dir) {
+    close(connfd);
+    connfd = -1;
+    unlink(address.sun_path);
+    rmdir(dir);
+}
+
+/**
+ * Run the main loop of jautolock (see daemon.h) with tasks on the
+ * scratch socket until it is stopped, then wait for the tasks still
+ * running.
+ */
+static void run_daemon(struct Task *tasks, unsigned n,
+        void (*cycled)(struct Daemon *daemon, struct timespec *timeout)) {
+    struct Daemon scratch = {
+        .tasks = tasks,
+        .n_task = n,
+        .sigfd = sigfd,
+        .connfd = connfd,
+        .own_socket = true,
+        .cycled = cycled,
+    };
+    daemon_run(&scratch);
+    for(unsigned i = 0; i < n; i++)
+        if(tasks[i].pid) {
+            if(waitpid(tasks[i].pid, NULL, 0) < 0)
+                die_perror("waitpid");
+            tasks[i].pid = 0;
+        }
+}
+
+/**
+ * Messages answered per second, one client at a time,
+ * and what the wait for them costs.
+ */
+static void scenario_throughput(const char *loop) {
+    const unsigned long count = 20000;
+    unsigned long long waits, syscalls, waits2, syscalls2;
+    loop_stats(&waits, &syscalls);
+
+    struct Task *tasks = make_tasks(1, (struct timespec) {3600, 0},
+            (struct timespec) {1, 0});
+    timecalc_init();
+    clock_gettime(CLOCK_MONOTONIC, &last_input);
+    uint64_t start = now_ns();
+    pthread_t client = start_client(count);
+    run_daemon(tasks, 1, NULL);
+    uint64_t elapsed = now_ns() - start;
+    pthread_join(client, NULL);
+    free(tasks);
+
+    loop_stats(&waits2, &syscalls2);
+    printf("{\"scenario\": \"control_throughput\", \"loop\": \"%s\", "
+            "\"messages\": %lu, \"messages_per_sec\": %.0f, "
+            "\"waits\": %llu, \"syscalls_per_wait\": %.2f}\n",
+            loop, count, count * 1e9 / elapsed, waits2 - waits,
+            (double) (syscalls2 - syscalls) / (waits2 - waits));
+}
+
+/**
+ * How late tasks are fired, optionally while a client floods
+ * the control socket. Returns the 90th percentile, which unlike the
+ * slowest few is not up to whatever else the machine is doing.
+ */
+static uint64_t scenario_lateness(const char *loop, bool flood) {
+    const unsigned n = 50;
+    const struct timespec first = {0, 20000000}, interval = {0, 10000000};
+    struct Task *tasks = make_tasks(n, first, interval);
+
+    pthread_t client;
+    if(flood)
+        client = start_client(0);
+    uint64_t lateness[n];
+    measure_lateness(tasks, n, flood, lateness);
+    if(flood)
+        pthread_join(client, NULL);
+
+    printf("{\"scenario\": \"fire_lateness\", \"loop\": \"%s\", "
+            "\"flood\": %s, \"messages\": %lu, \"tasks\": %u, ",
+            loop, flood ? "true" : "false",
+            flood ? (unsigned long) atomic_load(&client_sent) : 0, n);
+    uint64_t p90 = report_percentiles(lateness, n, 90);
+    // lateness is now sorted; tasks are 10ms apart, so with a floor
+    // on every sleep most of them would be fired several ms late
+    if(!flood)
+        check(lateness[n / 2] <= 2000000,
+                "tasks are fired within 2ms of their deadline (median)");
+    free(tasks);
+    return p90;
+}
+
+/**
+ * How long a message waits while another client is connected
+ * but sends nothing.
+ */
+static void scenario_silent_client(const char *loop) {
+    int silent = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(silent < 0 || connect(silent, (const struct sockaddr *) &address,
+                sizeof(address)) < 0)
+        die_perror("connect");
+
+    struct Task *tasks = make_tasks(1, (struct timespec) {3600, 0},
+            (struct timespec) {1, 0});
+    timecalc_init();
+    clock_gettime(CLOCK_MONOTONIC, &last_input);
+    uint64_t start = now_ns();
+    pthread_t client = start_client(1);
+    run_daemon(tasks, 1, NULL);
+    pthread_join(client, NULL);
+    uint64_t elapsed = now_ns() - start;
+    close(silent);
+    free(tasks);
+
+    printf("{\"scenario\": \"silent_client\", \"loop\": \"%s\", "
+            "\"answered\": %lu, \"latency_us\": %.1f}\n", loop,
+            (unsigned long) atomic_load(&client_sent), elapsed / 1e3);
+    check(atomic_load(&client_sent) == 1 && elapsed < 100000000,
+            "a silent client does not hold up others");
+}
+
+/**
+ * Stop the control thread while messages it has read wait for the
+ * scheduler, as a reexec does, and answer them afterwards. Done more
+ * times than messages may be in flight, so none may be left counted.
+ */
+static void scenario_control_stop(void) {
+    char dir[] = "/tmp/jautolock-bench.XXXXXX";
+    open_control(dir);
+    enum { rounds = 10, per_round = 8 };
+    unsigned answered = 0;
+    for(unsigned round = 0; round < rounds; round++) {
+        int ctlfd = control_start(connfd);
+        int fds[per_round];
+        for(unsigned i = 0; i < per_round; i++) {
+            fds[i] = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+            struct timeval wait = {1, 0};
+            if(fds[i] < 0 || setsockopt(fds[i], SOL_SOCKET, SO_RCVTIMEO,
+                        &wait, sizeof(wait)) < 0 ||
+                    connect(fds[i], (const struct sockaddr *) &address,
+                        sizeof(address)) < 0 ||
+                    send(fds[i], "unbusy", 6, MSG_EOR) < 0)
+                die_perror("send");
+        }
+        // let the thread read them, but take none yet
+        struct pollfd queued = {.fd = ctlfd, .events = POLLIN};
+        if(poll(&queued, 1, 1000) < 0)
+            die_perror("poll");
+        nanosleep(&(struct timespec) {0, 10000000}, NULL);
+
+        control_stop();
+        struct Command cmd;
+        while(control_receive(&cmd))
+            control_respond(&cmd, strdup("answered"));
+        for(unsigned i = 0; i < per_round; i++) {
+            char response[256];
+            ssize_t sz = read(fds[i], response, sizeof(response) - 1);
+            if(sz > 0) {
+                response[sz] = '\0';
+                answered += strcmp(response, "answered") == 0;
+            }
+            close(fds[i]);
+        }
+    }
+    close_control(dir);
+
+    printf("{\"scenario\": \"control_stop\", \"sent\": %u, "
+            "\"answered\": %u}\n", rounds * per_round, answered);
+    check(answered == rounds * per_round,
+            "messages read when the control thread stops are answered");
+}
+
+/**
+ * Kill the child of a prewarmed task before the deadline,
+ * and see that the task is still fired, whether jautolock has reaped
+ * the child by then or not.
+ */
+static void scenario_killed_prewarm(void) {
+    // as in jautolock.c
+    signal(SIGPIPE, SIG_IGN);
+    char dir[] = "/tmp/jautolock-bench.XXXXXX";
+    open_control(dir);
+
+    // reaped first, while no SIGCHLD is pending
+    for(int reaped = 1; reaped >= 0; reaped--) {
+        struct Task *task = make_tasks(1, (struct timespec) {0, 100000000},
+                (struct timespec) {0, 0});
+        task->command = "echo fired";
+        task->log.size = 64;
+        task->prewarm = (struct timespec) {1, 0};
+        memset(&killed, 0, sizeof(killed));
+        killed.reaped = reaped;
+        timecalc_init();
+        clock_gettime(CLOCK_MONOTONIC, &last_input);
+        killed.start = now_ns();
+        run_daemon(task, 1, kill_prewarmed);
+
+        char *log = output_get(task);
+        printf("{\"scenario\": \"killed_prewarm\", \"reaped\": %s, "
+                "\"late_us\": %.1f}\n", reaped ? "true" : "false",
+                killed.late / 1e3);
+        if(reaped)
+            check(killed.forgotten,
+                    "a prewarmed child that died is forgotten when reaped");
+        check(!killed.rewarmed, "a prewarmed child that died is not "
+                "forked again for the same deadline");
+        check(killed.fired && killed.fired != killed.warm &&
+                strcmp(log, "fired\n") == 0,
+                "a task whose prewarmed child was killed is still fired");
+        free(log);
+        free(task->log.data);
+        free(task);
+    }
+    close_control(dir);
+}
+
+// Kill the prewarmed child, and stop once the task has been fired
+// and its output read (or after a second).
+static void kill_prewarmed(struct Daemon *daemon, struct timespec *timeout) {
+    const struct Task *task = daemon->tasks;
+    if(task->warm_pid && !killed.warm) {
+        killed.warm = task->warm_pid;
+        if(kill(killed.warm, SIGKILL) < 0)
+            die_perror("kill");
+        // dead, but not seen by the main loop
+        if(!killed.reaped && waitpid(killed.warm, NULL, 0) < 0)
+            die_perror("waitpid");
+    } else if(killed.warm && task->warm_pid != killed.warm) {
+        killed.forgotten = true;
+        killed.rewarmed |= task->warm_pid != 0;
+    }
+    uint64_t now = now_ns();
+    if(task->pid && !killed.fired) {
+        killed.fired = task->pid;
+        killed.late = now - killed.start - timespec_ns(task->time);
+    }
+    if((killed.fired && !task->pid && task->outfd < 0) ||
+            now - killed.start >= 1000000000)
+        daemon_stop(0);
+    timespec_minify(timeout, (struct timespec) {0, 100000000});
+}
+
+/**
+ * Run a locker that repeats every 25ms and keeps running,
+ * and see that the idle time is queried less and less often,
+ * up to poll_max, and that activity between queries is still found
+ * and postpones the task after the locker.
+ */
+static void scenario_poll_backoff(void) {
+    char dir[] = "/tmp/jautolock-bench.XXXXXX";
+    open_control(dir);
+    const uint64_t poll_max = 200000000;
+    timecalc_set_poll_max(ns_timespec(poll_max));
+
+    // without activity, the second would be fired after a second
+    struct Task *tasks = make_tasks(2, (struct timespec) {0, 25000000},
+            (struct timespec) {0, 975000000});
+    tasks[0].every = tasks[0].time;
+    tasks[0].command = "exec sleep 5";
+    memset(&backoff, 0, sizeof(backoff));
+    timecalc_init();
+    clock_gettime(CLOCK_MONOTONIC, &last_input);
+    unsigned long long made, avoided;
+    timecalc_get_samples(&made, &avoided);
+    backoff.made = made;
+    backoff.start = now_ns();
+    run_daemon(tasks, 2, poll_backing_off);
+    unsigned long long made2, avoided2;
+    timecalc_get_samples(&made2, &avoided2);
+
+    printf("{\"scenario\": \"poll_backoff\", \"gaps_ms\": [");
+    for(unsigned i = 0; i < backoff.n_gap; i++)
+        printf("%s%.1f", i ? ", " : "", backoff.gaps[i] / 1e6);
+    printf("], \"queries\": %llu, \"avoided\": %llu, "
+            "\"noticed_ms\": %.1f, \"fired_ms\": %.1f}\n",
+            made2 - made, avoided2 - avoided, backoff.noticed / 1e6,
+            backoff.fired / 1e6);
+    uint64_t longest = 0;
+    bool grew = backoff.n_gap >= 4;
+    for(unsigned i = 0; i < backoff.n_gap; i++) {
+        if(i && backoff.gaps[i] + 5000000 < backoff.gaps[i - 1])
+            grew = false;
+        if(backoff.gaps[i] > longest)
+            longest = backoff.gaps[i];
+    }
+    check(grew && backoff.gaps[0] < 50000000 &&
+            longest >= poll_max - 10000000 && longest < poll_max + 50000000,
+            "the idle time is queried less often up to poll_max "
+            "while a task runs");
+    check(avoided2 - avoided > made2 - made,
+            "most cycles do without querying the idle time");
+    // activity at 700ms, found by polling before the second is due
+    check(backoff.noticed && backoff.noticed < 1000000000,
+            "activity is noticed while a task runs");
+    check(backoff.fired >= 1600000000,
+            "activity found by polling postpones the next task");
+
+    timecalc_set_poll_max((struct timespec) {60, 0});
+    close_control(dir);
+    free(tasks);
+}
+
+// Note when the idle time is queried, be active after 700ms,
+// and stop once the second task has been fired (or after 2.5s).
+static void poll_backing_off(struct Daemon *daemon, struct timespec *timeout) {
+    const uint64_t activity = 700000000, end = 2500000000;
+    uint64_t now = now_ns() - backoff.start;
+    unsigned long long made, avoided;
+    timecalc_get_samples(&made, &avoided);
+    if(made != backoff.made) {
+        backoff.made = made;
+        if(backoff.active && !backoff.noticed)
+            backoff.noticed = now;
+        else if(!backoff.active && backoff.sampled &&
+                backoff.n_gap < sizeof(backoff.gaps) / sizeof(uint64_t))
+            backoff.gaps[backoff.n_gap++] = now - backoff.sampled;
+        backoff.sampled = now;
+    }
+    if(!backoff.active && now >= activity) {
+        clock_gettime(CLOCK_MONOTONIC, &last_input);
+        backoff.active = true;
+    }
+    if(daemon->tasks[1].pid && !backoff.fired)
+        backoff.fired = now;
+    if(backoff.fired || now >= end) {
+        if(daemon->tasks[0].pid)
+            kill(daemon->tasks[0].pid, SIGKILL);
+        daemon_stop(0);
+    } else if(!backoff.active) {
+        timespec_minify(timeout, ns_timespec(activity - now));
+    } else {
+        timespec_minify(timeout, ns_timespec(end - now));
+    }
+}
+
+/**
+ * Unplug a fake AC supply while tasks are timed, and see that
+ * the tasks are enabled and disabled accordingly, and that only
+ * the task enabled by it is timed from then.
+ */
+static void scenario_power(void) {
+    char dir[] = "/tmp/jautolock-bench.XXXXXX";
+    open_control(dir);
+    make_supplies(dir, true);
+    char power[64];
+    snprintf(power, sizeof(power), "%s/power", dir);
+
+    // on AC, on battery and on any after 200ms, 150ms and 300ms
+    const unsigned n = 3;
+    struct Task *tasks = make_tasks(n, (struct timespec) {0, 200000000},
+            (struct timespec) {0, 0});
+    tasks[0].power = POWER_AC;
+    tasks[1].power = POWER_BATTERY;
+    tasks[1].time = tasks[1].step = (struct timespec) {0, 150000000};
+    tasks[2].time = tasks[2].step = (struct timespec) {0, 300000000};
+    power_init(power, tasks, n);
+    check(!tasks[0].disabled && tasks[1].disabled && !tasks[2].disabled,
+            "tasks for battery are disabled on AC");
+
+    // unplugged after 100ms
+    timecalc_init();
+    clock_gettime(CLOCK_MONOTONIC, &last_input);
+    memset(&ac, 0, sizeof(ac));
+    ac.dir = power;
+    ac.start = now_ns();
+    run_daemon(tasks, n, unplug_ac);
+
+    printf("{\"scenario\": \"power\", \"ac_fired\": %s, "
+            "\"battery_ms\": %.1f, \"any_ms\": %.1f}\n",
+            ac.fired[0] ? "true" : "false",
+            ac.fired[1] / 1e6, ac.fired[2] / 1e6);
+    check(tasks[0].disabled && !tasks[1].disabled && !tasks[2].disabled,
+            "tasks for AC are disabled on battery");
+    check(!ac.fired[0], "a task for AC is not fired on battery");
+    // 150ms after the change, not after inactivity started
+    check(ac.fired[1] >= 240000000 && ac.fired[1] < 330000000,
+            "a task enabled by a change is timed from it");
+    // and not delayed by 100ms like after activity
+    check(ac.fired[2] >= 290000000 && ac.fired[2] < 380000000,
+            "a change does not delay a task for any");
+
+    write_supply(power, "AC", "online", "1");
+    ac.start = now_ns();
+    run_daemon(tasks, n, wait_ac);
+    check(!tasks[0].disabled && tasks[1].disabled && !tasks[2].disabled,
+            "tasks for battery are disabled on AC again");
+
+    remove_supplies(dir);
+    close_control(dir);
+    free(tasks);
+}
+
+// Note when the tasks are fired, unplug AC after 100ms and stop after 600ms.
+static void unplug_ac(struct Daemon *daemon, struct timespec *timeout) {
+    const uint64_t unplug = 100000000, end = 600000000;
+    uint64_t now = now_ns() - ac.start;
+    for(unsigned i = 0; i < daemon->n_task; i++)
+        if(daemon->tasks[i].pid && !ac.fired[i])
+            ac.fired[i] = now;
+    if(!ac.unplugged && now >= unplug) {
+        write_supply(ac.dir, "AC", "online", "0");
+        ac.unplugged = true;
+    }
+    if(now >= end)
+        daemon_stop(0);
+    else
+        timespec_minify(timeout,
+                ns_timespec((ac.unplugged ? end : unplug) - now));
+}
+
+// Stop once the task for AC is enabled again (or after a second).
+static void wait_ac(struct Daemon *daemon, struct timespec *timeout) {
+    if(!daemon->tasks[0].disabled || now_ns() - ac.start >= 1000000000)
+        daemon_stop(0);
+    timespec_minify(timeout, (struct timespec) {0, 100000000});
+}
+
+// Write attribute attr of a supply in a fake power_supply directory.
+static void write_supply(const char *dir, const char *supply,
+        const char *attr, const char *value) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%s", dir, supply);
+    if(mkdir(path, 0755) < 0 && errno != EEXIST)
+        die_perror("mkdir");
+    snprintf(path, sizeof(path), "%s/%s/%s", dir, supply, attr);
+    FILE *f = fopen(path, "we");
+    if(!f)
+        die_perror("fopen");
+    fprintf(f, "%s\n", value);
+    fclose(f);
+}
+
+// A fake power_supply directory dir/power, with AC and a battery.
+static void make_supplies(const char *dir, bool on_ac) {
+    char power[64];
+    snprintf(power, sizeof(power), "%s/power", dir);
+    if(mkdir(power, 0755) < 0)
+        die_perror("mkdir");
+    write_supply(power, "AC", "type", "Mains");
+    write_supply(power, "AC", "online", on_ac ? "1" : "0");
+    write_supply(power, "BAT0", "type", "Battery");
+}
+
+static void remove_supplies(const char *dir) {
+    const char *files[] = {"AC/type", "AC/online", "BAT0/type", "AC", "BAT0",
+        ""};
+    for(unsigned i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "%s/power/%s", dir, files[i]);
+        if(remove(path) < 0)
+            die_perror("remove");
+    }
+}
+
+/**
+ * Restart with a reexec message while the locker is running, as after
+ * upgrading jautolock, and see that the new instance does not fire
+ * another one, and still times a task enabled by plugging AC in from
+ * then. The same binary is run with --restored to check that.
+ */
+static void scenario_reexec(void) {
+    char dir[] = "/tmp/jautolock-bench.XXXXXX";
+    open_control(dir);
+    struct Task *tasks = make_locker(dir);
+    // on battery until the locker runs
+    make_supplies(dir, false);
+    char power[64];
+    snprintf(power, sizeof(power), "%s/power", dir);
+    timecalc_init();
+    clock_gettime(CLOCK_MONOTONIC, &last_input);
+    power_init(power, tasks, 2);
+    loop_init(LOOP_SELECT);
+
+    char *argv[] = {"/proc/self/exe", "--restored", dir, NULL};
+    struct Daemon locking = {
+        .tasks = tasks,
+        .n_task = 2,
+        .sigfd = sigfd,
+        .connfd = connfd,
+        .own_socket = true,
+        .argv = argv,
+        .cycled = request_reexec,
+    };
+    daemon_run(&locking);
+    die("reexec failed.\n");
+}
+
+/**
+ * Once the locker runs, plug AC in, and once the task for it is
+ * enabled, ask for a reexec from another process.
+ */
+static void request_reexec(struct Daemon *daemon, struct timespec *timeout) {
+    static bool plugged = false, requested = false;
+    if(!daemon->tasks[0].pid || requested)
+        return;
+    if(!plugged) {
+        char power[64];
+        snprintf(power, sizeof(power), "%s/power", daemon->argv[2]);
+        write_supply(power, "AC", "online", "1");
+        plugged = true;
+    }
+    if(daemon->tasks[1].disabled) {
+        timespec_minify(timeout, (struct timespec) {0, 10000000});
+        return;
+    }
+    requested = true;
+    pid_t pid = fork();
+    if(pid < 0)
+        die_perror("fork");
+    if(pid == 0)
+        reexec_client(daemon->argv[2]);
+}
+
+/**
+ * Like "jautolock reexec", followed right away by a burst of messages
+ * that cross the restart. Writes how many of them are answered to
+ * dir/answered, for run_restored().
+ *
+ * Forked from a process with threads, so it sticks to system calls.
+ */
+static void reexec_client(const char *dir) {
+    int fds[1 + reexec_burst];
+    for(unsigned i = 0; i < 1 + reexec_burst; i++) {
+        const char *message = i ? "unbusy" : "reexec";
+        fds[i] = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if(fds[i] < 0 || connect(fds[i], (const struct sockaddr *) &address,
+                    sizeof(address)) < 0 ||
+                send(fds[i], message, strlen(message), MSG_EOR) < 0)
+            _exit(1);
+    }
+    unsigned answered = 0;
+    for(unsigned i = 0; i < 1 + reexec_burst; i++) {
+        char response[256];
+        answered += read(fds[i], response, sizeof(response)) > 0;
+        close(fds[i]);
+    }
+
+    char path[64], tmp[64], count[16];
+    snprintf(path, sizeof(path), "%s/answered", dir);
+    snprintf(tmp, sizeof(tmp), "%s/answered.tmp", dir);
+    int len = snprintf(count, sizeof(count), "%u", answered);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd < 0 || write(fd, count, len) != len || close(fd) < 0 ||
+            rename(tmp, path) < 0)
+        _exit(1);
+    _exit(0);
+}
+
+/**
+ * A task fired after 50ms, that logs a line to dir/log after a while,
+ * and a task for AC fired 600ms after it is enabled.
+ */
+static struct Task *make_locker(const char *dir) {
+    static char log_file[64];
+    snprintf(log_file, sizeof(log_file), "%s/log", dir);
+    struct Task *tasks = make_tasks(2, (struct timespec) {0, 50000000},
+            (struct timespec) {0, 0});
+    tasks[0].name = "lock";
+    tasks[0].command = "sleep 0.3; echo locked";
+    tasks[0].log_file = log_file;
+    tasks[1].name = "charge";
+    tasks[1].time = tasks[1].step = (struct timespec) {0, 600000000};
+    tasks[1].power = POWER_AC;
+    return tasks;
+}
+
+/**
+ * Pass a listening socket as a service manager would (LISTEN_FDS),
+ * to the same binary run with --activated.
+ */
+static void scenario_activated(void) {
+    char dir[] = "/tmp/jautolock-bench.XXXXXX";
+    if(!mkdtemp(dir))
+        die_perror("mkdtemp");
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s/socket", dir);
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if(fd < 0)
+        die_perror("socket");
+    if(bind(fd, (const struct sockaddr *) &address, sizeof(address)) < 0)
+        die_perror("bind");
+    if(listen(fd, 20) < 0)
+        die_perror("listen");
+    // the first passed descriptor is 3, whatever was there is not needed
+    if(fd != 3 && (dup2(fd, 3) < 0 || close(fd) < 0))
+        die_perror("dup2");
+
+    char pid[16];
+    snprintf(pid, sizeof(pid), "%d", (int) getpid());
+    setenv("LISTEN_PID", pid, 1);
+    setenv("LISTEN_FDS", "1", 1);
+    execl("/proc/self/exe", "jautolock-bench", "--activated", dir,
+            (char *) NULL);
+    die_perror("execl");
+}
+
+/**
+ * Ask for keep-alive pings like systemd's WatchdogSec= would,
+ * and see that they are sent, but not while the main loop is stuck
+ * for longer than budget (if zero, than the 100ms between pings).
+ */
+static void scenario_watchdog(struct timespec budget) {
+    char name[64];
+    snprintf(name, sizeof(name), "@jautolock-bench-%d", (int) getpid());
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    memcpy(addr.sun_path, name, strlen(name));
+    addr.sun_path[0] = '\0';
+    socklen_t len = offsetof(struct sockaddr_un, sun_path) + strlen(name);
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(fd < 0 || bind(fd, (const struct sockaddr *) &addr, len) < 0)
+        die_perror("bind");
+    struct timeval second = {1, 0};
+    if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &second, sizeof(second)) < 0)
+        die_perror("setsockopt");
+
+    // a ping every 100ms
+    char pid[16];
+    snprintf(pid, sizeof(pid), "%d", (int) getpid());
+    setenv("NOTIFY_SOCKET", name, 1);
+    setenv("WATCHDOG_USEC", "200000", 1);
+    setenv("WATCHDOG_PID", pid, 1);
+    watchdog_start(budget);
+    watch_beat();
+    watch_phase(WATCH_WAIT);
+    char buf[64];
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    check(n == 10 && memcmp(buf, "WATCHDOG=1", 10) == 0,
+            "keep-alive pings are sent to NOTIFY_SOCKET");
+
+    // stuck for 450ms; a ping may be sent before it is noticed
+    watch_beat();
+    nanosleep(&(struct timespec) {0, 150000000}, NULL);
+    while(recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+        continue;
+    nanosleep(&(struct timespec) {0, 300000000}, NULL);
+    bool held = recv(fd, buf, sizeof(buf), MSG_DONTWAIT) < 0;
+    watch_phase(WATCH_WAIT);
+    bool resumed = recv(fd, buf, sizeof(buf), 0) > 0;
+
+    printf("{\"scenario\": \"watchdog\", \"budget_ms\": %lld, "
+            "\"held_while_stuck\": %s, \"resumed\": %s, \"stalls\": %llu}\n",
+            (long long) timespec_ns(budget) / 1000000,
+            held ? "true" : "false", resumed ? "true" : "false",
+            watchdog_stalls());
+    check(held && watchdog_stalls() == 1,
+            "no keep-alive ping is sent while the main loop is stuck");
+    check(resumed, "keep-alive pings resume once the main loop is not stuck");
+    close(fd);
+    unsetenv("NOTIFY_SOCKET");
+    unsetenv("WATCHDOG_USEC");
+    unsetenv("WATCHDOG_PID");
+}
+
+// Whether all threads have the policy and nice value of this one.
+static bool threads_alike(void) {
+    long self[2];
+    read_sched("/proc/thread-self/stat", self);
+    DIR *dir = opendir("/proc/self/task");
+    if(!dir)
+        die_perror("opendir");
+    bool alike = true;
+    struct dirent *ent;
+    while((ent = readdir(dir))) {
+        if(ent->d_name[0] == '.')
+            continue;
+        char path[sizeof(ent->d_name) + 32];
+        snprintf(path, sizeof(path), "/proc/self/task/%s/stat", ent->d_name);
+        long other[2];
+        read_sched(path, other);
+        alike &= other[0] == self[0] && other[1] == self[1];
+    }
+    closedir(dir);
+    return alike;
+}
+
+// Read the nice value and the policy of a thread from its stat file.
+static void read_sched(const char *path, long *sched) {
+    char stat[1024];
+    FILE *f = fopen(path, "re");
+    if(!f || !fgets(stat, sizeof(stat), f))
+        die_perror("read stat");
+    fclose(f);
+    // fields 19 and 41, counted after the name (field 2),
+    // which may contain anything
+    char *p = strrchr(stat, ')');
+    for(int i = 3, k = 0; p && k < 2; i++) {
+        p = strchr(p + 1, ' ');
+        if(p && (i == 19 || i == 41))
+            sched[k++] = strtol(p + 1, NULL, 10);
+    }
+    if(!p)
+        die("Cannot parse %s.\n", path);
+}
+
+/**
+ * How late tasks are fired while every CPU is kept busy and memory
+ * is churned by other processes, with or without the low latency
+ * settings (locked memory and SCHED_FIFO, see priority.h).
+ */
+static void run_load(bool low_latency) {
+    loop_init(LOOP_SELECT);
+    char dir[] = "/tmp/jautolock-bench.XXXXXX";
+    open_control(dir);
+
+    long n_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n_cpu < 1)
+        n_cpu = 1;
+    pid_t burners[n_cpu + 1];
+    for(long i = 0; i <= n_cpu; i++)
+        burners[i] = start_burner(i == n_cpu);
+    // after forking the burners, though they would not inherit it anyway
+    if(low_latency) {
+        struct Priority priority = {true, SCHED_FIFO, 1, INT_MIN};
+        priority_apply(&priority);
+        // SCHED_RESET_ON_FORK applies to new threads too
+        control_start(connfd);
+        // once it has had a chance to run
+        bool alike = false;
+        for(int tries = 0; tries < 100 && !alike; tries++) {
+            nanosleep(&(struct timespec) {0, 1000000}, NULL);
+            alike = threads_alike();
+        }
+        control_stop();
+        printf("{\"scenario\": \"thread_policy\", \"policy\": \"%s\", "
+                "\"threads_alike\": %s}\n", priority_policy_name(),
+                alike ? "true" : "false");
+        check(alike, "the control thread gets the policy of jautolock");
+    }
+
+    // further apart than the shortest sleep of timecalc
+    const unsigned n = 100;
+    const struct timespec first = {0, 100000000}, interval = {0, 50000000};
+    struct Task *tasks = make_tasks(n, first, interval);
+    uint64_t lateness[n];
+    measure_lateness(tasks, n, false, lateness);
+
+    for(long i = 0; i <= n_cpu; i++) {
+        kill(burners[i], SIGKILL);
+        waitpid(burners[i], NULL, 0);
+    }
+    printf("{\"scenario\": \"fire_lateness_load\", "
+            "\"low_latency\": %s, \"policy\": \"%s\", \"burners\": %ld, "
+            "\"tasks\": %u, ", low_latency ? "true" : "false",
+            priority_policy_name(), n_cpu, n);
+    report_percentiles(lateness, n, 99);
+    close_control(dir);
+    free(tasks);
+}
+
+// A child spinning on a CPU, or touching 256 MiB of new memory over and over.
+static pid_t start_burner(bool pressure) {
+    pid_t pid = fork();
+    if(pid < 0)
+        die_perror("fork");
+    if(pid)
+        return pid;
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    const size_t size = 256 << 20;
+    while(true) {
+        if(!pressure) {
+            sink++;
+            continue;
+        }
+        char *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED)
+            _exit(EXIT_FAILURE);
+        for(size_t i = 0; i < size; i += 4096)
+            p[i] = 1;
+        munmap(p, size);
+    }
+}
+
+/**
+ * Run the main loop until each task has been fired once,
+ * and store how late each firing was in lateness.
+ * If client is set, the client is stopped instead of the loop,
+ * which it then asks to exit.
+ */
+static void measure_lateness(struct Task *tasks, unsigned n, bool client,
+        uint64_t *lateness) {
+    bool measured[n];
+    memset(measured, 0, sizeof(measured));
+    timing.lateness = lateness;
+    timing.measured = measured;
+    timing.fired = 0;
+    timing.client = client;
+
+    timecalc_init();
+    clock_gettime(CLOCK_MONOTONIC, &last_input);
+    timing.start = (uint64_t) last_input.tv_sec * 1000000000 +
+        last_input.tv_nsec;
+    run_daemon(tasks, n, time_fired);
+}
+
+// Note how late the tasks fired in this cycle are.
+static void time_fired(struct Daemon *daemon, struct timespec *timeout) {
+    (void) timeout;
+    // each task is fired once, and (being "true") soon reaped
+    uint64_t now = now_ns();
+    for(unsigned i = 0; i < daemon->n_task; i++)
+        if(daemon->tasks[i].pid && !timing.measured[i]) {
+            timing.measured[i] = true;
+            timing.lateness[timing.fired++] = now - timing.start -
+                timespec_ns(daemon->tasks[i].time);
+        }
+    if(timing.fired < daemon->n_task)
+        return;
+    if(timing.client)
+        atomic_store(&client_stop, true);
+    else
+        daemon_stop(0);
+}
+
+// Wait for a child running scenarios, and die if they failed.
+static void wait_scenarios(pid_t pid) {
+    int status;
+    if(waitpid(pid, &status, 0) < 0)
+        die_perror("waitpid");
+    if(!WIFEXITED(status) || WEXITSTATUS(status))
+        die("Scenarios failed.\n");
+}
+
+/**
+ * Start a client thread that sends count messages (or until client_stop
+ * if count is 0), and then "exit".
+ */
+static pthread_t start_client(unsigned long count) {
+    atomic_store(&client_stop, false);
+    atomic_store(&client_sent, 0);
+    pthread_t client;
+    if(pthread_create(&client, NULL, client_main, (void *) count))
+        die("pthread_create failed.\n");
+    return client;
+}
+
+// like "jautolock unbusy" (or another client_message) would
+static void *client_main(void *arg) {
+    unsigned long count = (unsigned long) arg;
+    while(count ? atomic_load(&client_sent) < count :
+            !atomic_load(&client_stop)) {
+        if(!send_one(client_message))
+            break;
+        atomic_fetch_add(&client_sent, 1);
+    }
+    send_one("exit");
+    return NULL;
+}
+
+static bool send_one(const char *message) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        return false;
+    char response[256];
+    bool ok = connect(fd, (const struct sockaddr *) &address,
+                sizeof(address)) == 0 &&
+        send(fd, message, strlen(message), MSG_EOR) >= 0 &&
+        read(fd, response, sizeof(response)) > 0;
+    close(fd);
+    return ok;
+}
+
+// tasks running "true", the i-th after first + i * interval
+static struct Task *make_tasks(unsigned n, struct timespec first,
+        struct timespec interval) {
+    struct Task *tasks = calloc(n, sizeof(struct Task));
+    if(!tasks)
+        die_perror("calloc");
+    for(unsigned i = 0; i < n; i++) {
+        tasks[i].time = ns_timespec(timespec_ns(first) +
+                (int64_t) i * timespec_ns(interval));
+        tasks[i].step = tasks[i].time;
+        tasks[i].name = "bench";
+        tasks[i].command = "true";
+        tasks[i].outfd = -1;
+        tasks[i].logfd = -1;
+        tasks[i].warm_fd = -1;
+        tasks[i].cgroupfd = -1;
+        tasks[i].nice = INT_MIN;
+    }
+    return tasks;
+}
+
+// finish a JSON object with percentiles of samples (in microseconds),
+// and return the one asked for (in nanoseconds)
+static uint64_t report_percentiles(uint64_t *samples, unsigned n,
+        unsigned percentile) {
+    qsort(samples, n, sizeof(uint64_t), compare_u64);
+    printf("\"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, "
+            "\"max_us\": %.1f}\n", samples[n / 2] / 1e3,
+            samples[n * 9 / 10] / 1e3, samples[n * 99 / 100] / 1e3,
+            samples[n - 1] / 1e3);
+    return samples[n * percentile / 100];
+}
+
+// Stop (and fail) if a guarantee does not hold.
+static void check(bool ok, const char *what) {
+    if(!ok)
+        die("Check failed: %s.\n", what);
+}
+
+static int compare_u64(const void *lhs, const void *rhs) {
+    uint64_t l = *(const uint64_t *) lhs, r = *(const uint64_t *) rhs;
+    return l < r ? -1 : l > r;
+}
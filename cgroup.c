@@ -0,0 +1,383 @@
+/*
+ * cgroup.c - run tasks in cgroups of their own
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cgroup.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "die.h"
+#include "tasks.h"
+
+static int open_base(void);
+static int enter_own_leaf(int fd, const char *path);
+static void enable_controller(const char *name, bool required);
+static int open_leaf(const struct Task *task);
+static void leaf_name(const struct Task *task, char *name);
+static int write_file(int dirfd, const char *file, const char *s);
+static long long read_number(int dirfd, const char *file, const char *key);
+
+// cgroup v2 is mounted on the first in unified mode, the second in hybrid mode
+static const char *const mounts[] = {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"};
+// the leaf jautolock itself is moved to
+static const char *const own_leaf = "jautolock";
+
+// the cgroup holding the leaves of jautolock and of tasks
+static int base_fd = -1;
+// the controllers enabled for them, see enable_controller()
+static const char *enabled[2];
+static unsigned n_enabled;
+
+void cgroup_init(const char *dir, struct Task *tasks, unsigned n,
+        bool realtime) {
+    bool wanted = false, weight = false, memory = false;
+    for(unsigned i = 0; i < n; i++) {
+        wanted |= tasks[i].cgroup;
+        weight |= tasks[i].cpu_weight != 0;
+        memory |= tasks[i].memory_max != NULL;
+    }
+    if(!wanted)
+        return;
+    // with RT group scheduling, real-time processes can't be in (or be
+    // moved to) cgroups under the cpu controller without a runtime
+    // budget, which cgroup v2 has no way of giving
+    if(weight && realtime) {
+        fprintf(stderr, "WARNING: cpu_weight is ignored "
+                "with a real-time sched_policy\n");
+        weight = false;
+        for(unsigned i = 0; i < n; i++)
+            tasks[i].cpu_weight = 0;
+    }
+    if(dir) {
+        base_fd = open(dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if(base_fd < 0)
+            fprintf(stderr, "WARNING: cannot open cgroup %s: %s\n",
+                    dir, strerror(errno));
+        else
+            base_fd = enter_own_leaf(base_fd, dir);
+    } else {
+        base_fd = open_base();
+    }
+    if(base_fd < 0)
+        return;
+    // memory.peak needs the memory controller even without memory.max
+    enable_controller("memory", memory);
+    if(weight)
+        enable_controller("cpu", true);
+    for(unsigned i = 0; i < n; i++)
+        if(tasks[i].cgroup)
+            tasks[i].cgroupfd = open_leaf(tasks + i);
+}
+
+void cgroup_prepare(struct Task *task) {
+    if(task->cgroupfd < 0)
+        return;
+    // fails with EBUSY if something started by an earlier run is still there
+    char name[NAME_MAX + 1];
+    leaf_name(task, name);
+    if(unlinkat(base_fd, name, AT_REMOVEDIR) == 0) {
+        close(task->cgroupfd);
+        task->cgroupfd = open_leaf(task);
+        if(task->cgroupfd < 0)
+            return;
+    }
+    task->cpu_base = read_number(task->cgroupfd, "cpu.stat", "usage_usec");
+}
+
+void cgroup_enter(const struct Task *task) {
+    if(task->cgroupfd < 0)
+        return;
+    // "0" is the process writing it
+    if(write_file(task->cgroupfd, "cgroup.procs", "0") < 0) {
+        static const char msg[] =
+            "WARNING: cannot move the task to its cgroup\n";
+        if(write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0)
+            return;
+    }
+}
+
+void cgroup_collect(struct Task *task) {
+    if(task->cgroupfd < 0)
+        return;
+    task->runs++;
+    task->cpu_usec = read_number(task->cgroupfd, "cpu.stat", "usage_usec");
+    if(task->cpu_usec >= 0 && task->cpu_base > 0)
+        task->cpu_usec -= task->cpu_base;
+    // only since Linux 5.19
+    task->mem_peak = read_number(task->cgroupfd, "memory.peak", NULL);
+}
+
+char *cgroup_usage(const struct Task *tasks, unsigned n) {
+    char *s;
+    size_t len;
+    FILE *f = open_memstream(&s, &len);
+    if(!f)
+        die_perror("open_memstream");
+    bool any = false;
+    for(unsigned i = 0; i < n; i++) {
+        if(!tasks[i].cgroup)
+            continue;
+        fprintf(f, "%s%s: ", any ? "\n" : "", tasks[i].name);
+        any = true;
+        if(tasks[i].cgroupfd < 0) {
+            fputs("not in a cgroup", f);
+            continue;
+        }
+        if(tasks[i].runs == 0) {
+            fputs("not run yet", f);
+            continue;
+        }
+        fprintf(f, "ran %u times, the last run used ", tasks[i].runs);
+        if(tasks[i].cpu_usec >= 0)
+            fprintf(f, "%lld.%03lld s of CPU", tasks[i].cpu_usec / 1000000,
+                    tasks[i].cpu_usec / 1000 % 1000);
+        else
+            fputs("unknown CPU time", f);
+        if(tasks[i].mem_peak >= 0)
+            fprintf(f, ", at most %lld KiB of memory",
+                    tasks[i].mem_peak / 1024);
+    }
+    if(!any)
+        fputs("No task runs in a cgroup.", f);
+    if(fclose(f) != 0)
+        die_perror("fclose");
+    return s;
+}
+
+void cgroup_cleanup(struct Task *tasks, unsigned n) {
+    if(base_fd < 0)
+        return;
+    bool busy = false;
+    for(unsigned i = 0; i < n; i++) {
+        if(tasks[i].cgroupfd < 0)
+            continue;
+        close(tasks[i].cgroupfd);
+        tasks[i].cgroupfd = -1;
+        char name[NAME_MAX + 1];
+        leaf_name(tasks + i, name);
+        // fails with EBUSY if the task (or what it started) still runs
+        busy |= unlinkat(base_fd, name, AT_REMOVEDIR) < 0 && errno != ENOENT;
+    }
+    // a cgroup with controllers enabled for its children can't
+    // hold jautolock itself
+    for(unsigned i = 0; !busy && i < n_enabled; i++) {
+        char value[64];
+        snprintf(value, sizeof(value), "-%s", enabled[i]);
+        busy = write_file(base_fd, "cgroup.subtree_control", value) < 0;
+    }
+    if(!busy && write_file(base_fd, "cgroup.procs", "0") == 0)
+        unlinkat(base_fd, own_leaf, AT_REMOVEDIR);
+    close(base_fd);
+    base_fd = -1;
+    n_enabled = 0;
+}
+
+/**
+ * Open the cgroup jautolock is in, and move jautolock to
+ * its own leaf there, so the cgroup may have controllers enabled
+ * for its children. After a reexec, jautolock is in the leaf already.
+ * Returns -1 with a warning if that is not possible.
+ */
+static int open_base(void) {
+    FILE *f = fopen("/proc/self/cgroup", "re");
+    if(!f) {
+        fprintf(stderr, "WARNING: cannot read /proc/self/cgroup: %s\n",
+                strerror(errno));
+        return -1;
+    }
+    char line[PATH_MAX + 8];
+    char *path = NULL;
+    while(!path && fgets(line, sizeof(line), f))
+        if(strncmp(line, "0::/", 4) == 0)
+            path = line + 3;
+    fclose(f);
+    if(!path) {
+        fprintf(stderr, "WARNING: not in a cgroup v2 hierarchy, "
+                "tasks run without cgroups\n");
+        return -1;
+    }
+    path[strcspn(path, "\n")] = '\0';
+    char *slash = strrchr(path, '/');
+    bool moved = strcmp(slash + 1, own_leaf) == 0;
+    if(moved)
+        *slash = '\0';
+
+    int fd = -1;
+    for(unsigned i = 0; fd < 0 && i < sizeof(mounts) / sizeof(mounts[0]);
+            i++) {
+        char *dir;
+        if(asprintf(&dir, "%s/cgroup.controllers", mounts[i]) < 0)
+            die_perror("asprintf");
+        bool found = access(dir, F_OK) == 0;
+        free(dir);
+        if(!found)
+            continue;
+        if(asprintf(&dir, "%s%s", mounts[i], path) < 0)
+            die_perror("asprintf");
+        fd = open(dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        free(dir);
+    }
+    if(fd < 0) {
+        fprintf(stderr, "WARNING: cannot find cgroup %s, "
+                "tasks run without cgroups\n", path);
+        return -1;
+    }
+    if(moved)
+        return fd;
+    return enter_own_leaf(fd, path);
+}
+
+/**
+ * Move jautolock to its own leaf of the cgroup open as fd.
+ * Returns fd, or -1 with a warning (and fd closed) if that is not possible.
+ */
+static int enter_own_leaf(int fd, const char *path) {
+    char procs[NAME_MAX + 16];
+    snprintf(procs, sizeof(procs), "%s/cgroup.procs", own_leaf);
+    if((mkdirat(fd, own_leaf, 0755) < 0 && errno != EEXIST) ||
+            write_file(fd, procs, "0") < 0) {
+        fprintf(stderr, "WARNING: cannot move to a leaf of cgroup %s: %s\n"
+                "Is it delegated? Tasks run without cgroups.\n",
+                path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Enable the controller for the children of the base cgroup if available.
+static void enable_controller(const char *name, bool required) {
+    bool found = false;
+    int fd = openat(base_fd, "cgroup.controllers", O_RDONLY | O_CLOEXEC);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "r");
+    char line[256];
+    if(f && fgets(line, sizeof(line), f)) {
+        char *save;
+        for(char *word = strtok_r(line, " \n", &save); word && !found;
+                word = strtok_r(NULL, " \n", &save))
+            found = strcmp(word, name) == 0;
+    }
+    if(f)
+        fclose(f);
+    else if(fd >= 0)
+        close(fd);
+    if(!found) {
+        if(required)
+            fprintf(stderr, "WARNING: the %s controller is not available\n",
+                    name);
+        return;
+    }
+
+    char value[64];
+    snprintf(value, sizeof(value), "+%s", name);
+    if(write_file(base_fd, "cgroup.subtree_control", value) == 0)
+        enabled[n_enabled++] = name;
+    else if(required)
+        fprintf(stderr, "WARNING: cannot enable the %s controller: %s\n",
+                name, strerror(errno));
+}
+
+/**
+ * Create the leaf of the task if needed, and apply its limits.
+ * Returns -1 with a warning if that is not possible.
+ */
+static int open_leaf(const struct Task *task) {
+    char name[NAME_MAX + 1];
+    leaf_name(task, name);
+    if(mkdirat(base_fd, name, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "WARNING: cannot create cgroup %s: %s\n",
+                name, strerror(errno));
+        return -1;
+    }
+    int fd = openat(base_fd, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) {
+        fprintf(stderr, "WARNING: cannot open cgroup %s: %s\n",
+                name, strerror(errno));
+        return -1;
+    }
+
+    char weight[16];
+    snprintf(weight, sizeof(weight), "%d", task->cpu_weight);
+    const char *file = NULL;
+    if(task->cpu_weight && write_file(fd, "cpu.weight", weight) < 0)
+        file = "cpu.weight";
+    else if(task->memory_max &&
+            write_file(fd, "memory.max", task->memory_max) < 0)
+        file = "memory.max";
+    if(file) {
+        fprintf(stderr, "WARNING: cannot set %s of cgroup %s: %s\n",
+                file, name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// "task-" followed by the name of the task, with '/' replaced
+static void leaf_name(const struct Task *task, char *name) {
+    snprintf(name, NAME_MAX + 1, "task-%s", task->name);
+    for(char *s = name; (s = strchr(s, '/')); s++)
+        *s = '_';
+}
+
+// Returns -1 and sets errno on failure.
+static int write_file(int dirfd, const char *file, const char *s) {
+    int fd = openat(dirfd, file, O_WRONLY | O_CLOEXEC);
+    if(fd < 0)
+        return -1;
+    size_t len = strlen(s);
+    ssize_t written = write(fd, s, len);
+    int err = errno;
+    close(fd);
+    errno = err;
+    return written == (ssize_t) len ? 0 : -1;
+}
+
+/**
+ * Read the number after key in a flat keyed file like cpu.stat,
+ * or the number in a single value file if key is NULL.
+ * Returns -1 if not found.
+ */
+static long long read_number(int dirfd, const char *file, const char *key) {
+    int fd = openat(dirfd, file, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return -1;
+    FILE *f = fdopen(fd, "r");
+    if(!f) {
+        close(fd);
+        return -1;
+    }
+    long long value = -1;
+    char line[256];
+    size_t len = key ? strlen(key) : 0;
+    while(fgets(line, sizeof(line), f))
+        if(!key || (strncmp(line, key, len) == 0 && line[len] == ' ')) {
+            char *ep;
+            value = strtoll(line + len, &ep, 10);
+            if(ep == line + len)
+                value = -1;
+            break;
+        }
+    fclose(f);
+    return value;
+}
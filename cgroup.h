@@ -0,0 +1,67 @@
+/*
+ * cgroup.h - run tasks in cgroups of their own
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JAUTOLOCK_CGROUP_H
+#define JAUTOLOCK_CGROUP_H
+#include <stdbool.h>
+struct Task;
+/**
+ * Set up the cgroups of the tasks that ask for one.
+ *
+ * The cgroup v2 jautolock is in must be delegated to it.
+ * jautolock moves itself to a "jautolock" leaf there, and each task
+ * gets a sibling leaf "task-<name>" with its cpu.weight and memory.max.
+ *
+ * Anything not possible is reported by a warning, and the tasks
+ * affected run where jautolock does (task->cgroupfd stays -1).
+ *
+ * If realtime is set (jautolock is to run as SCHED_FIFO or SCHED_RR),
+ * the cpu controller is not enabled, and cpu.weight is not set.
+ *
+ * If dir is not NULL, it is used instead of the cgroup jautolock is in
+ * (for benchmarks).
+ */
+void cgroup_init(const char *dir, struct Task *tasks, unsigned n,
+        bool realtime);
+/**
+ * Called before forking the task: renew its leaf if it is empty,
+ * so the counters start from zero, and remember its CPU usage so far.
+ */
+void cgroup_prepare(struct Task *task);
+/**
+ * Called in the child: move itself to the leaf of the task.
+ * Only async-signal-safe functions are used.
+ */
+void cgroup_enter(const struct Task *task);
+/**
+ * Called when the task has been reaped:
+ * read back its CPU time and peak memory.
+ */
+void cgroup_collect(struct Task *task);
+/**
+ * Returns a free()-able description of the resource usage
+ * of the last run of each task in a cgroup.
+ */
+char *cgroup_usage(const struct Task *tasks, unsigned n);
+/**
+ * Called on the way out (not on reexec): remove the leaves of the tasks,
+ * then move jautolock back and remove its own leaf.
+ * If a task is still running, its leaf and the leaf of jautolock stay.
+ */
+void cgroup_cleanup(struct Task *tasks, unsigned n);
+#endif // JAUTOLOCK_CGROUP_H
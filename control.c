@@ -0,0 +1,382 @@
+/*
+ * control.c - serve the control socket on a dedicated thread
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "control.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "die.h"
+#include "priority.h"
+
+#define QUEUE_SIZE 64
+// connections whose message is still awaited
+#define MAX_PENDING 16
+
+/**
+ * Lock-free single-producer single-consumer queue of commands.
+ * head: next slot to be written, only advanced by the producer
+ * tail: next slot to be read, only advanced by the consumer
+ */
+struct Queue {
+    struct Command slots[QUEUE_SIZE];
+    atomic_size_t head;
+    atomic_size_t tail;
+};
+
+/**
+ * A connection whose message has not arrived yet.
+ * deadline: CLOCK_MONOTONIC time it is given up at
+ */
+struct Pending {
+    int datafd;
+    struct timespec deadline;
+};
+
+static void *control_main(void *arg);
+static void accept_connection(void);
+static void read_message(unsigned i);
+static int pending_timeout(void);
+static void expire_pending(bool all);
+static void remove_pending(unsigned i);
+static void handle_message(int datafd, const char *message);
+static void send_responses(void);
+static void reply_and_close(int datafd, const char *response);
+static bool queue_push(struct Queue *queue, const struct Command *cmd);
+static bool queue_pop(struct Queue *queue, struct Command *cmd);
+static void notify(int fd);
+static void clear(int fd);
+
+// how long a client may take to send its message (seconds)
+static const time_t receive_timeout = 1;
+// the thread needs little more than a message buffer
+static const size_t stack_size = 65536;
+
+static pthread_t thread;
+static int listenfd;
+// control thread -> scheduler
+static struct Queue commands;
+static int commands_fd;
+// scheduler -> control thread
+static struct Queue responses;
+static int responses_fd;
+static atomic_bool stopping;
+// only touched by the scheduler: whether the thread is running
+static bool running;
+// only touched by control thread
+// messages passed to the scheduler but not yet answered
+static unsigned in_flight;
+// connections read from as their messages arrive,
+// so a slow client does not hold up the others
+static struct Pending pending[MAX_PENDING];
+static unsigned n_pending;
+
+int control_activated_socket(void) {
+    const char *pid = getenv("LISTEN_PID");
+    const char *fds = getenv("LISTEN_FDS");
+    if(!pid || !fds || atol(pid) != getpid())
+        return -1;
+    int n = atoi(fds);
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    if(n < 1)
+        return -1;
+    if(n > 1)
+        fprintf(stderr, "WARNING: only the first of %d sockets is used\n", n);
+
+    const int fd = 3; // SD_LISTEN_FDS_START
+    int type;
+    socklen_t len = sizeof(type);
+    if(getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0)
+        die_perror("getsockopt");
+    if(type != SOCK_SEQPACKET)
+        die("Socket passed is not SOCK_SEQPACKET.\n");
+    if(fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+        die_perror("fcntl");
+    return fd;
+}
+
+int control_start(int connfd) {
+    listenfd = connfd;
+    atomic_store(&stopping, false);
+    commands_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(commands_fd < 0)
+        die_perror("eventfd");
+    responses_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(responses_fd < 0)
+        die_perror("eventfd");
+
+    pthread_attr_t attr;
+    int err = pthread_attr_init(&attr);
+    if(!err)
+        err = pthread_attr_setstacksize(&attr, stack_size);
+    if(err) {
+        errno = err;
+        die_perror("pthread_attr_setstacksize");
+    }
+
+    // signals are for the scheduler thread only
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    err = pthread_create(&thread, &attr, control_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+    if(err) {
+        errno = err;
+        die_perror("pthread_create");
+    }
+    running = true;
+    return commands_fd;
+}
+
+bool control_receive(struct Command *cmd) {
+    if(queue_pop(&commands, cmd))
+        return true;
+    if(!running)
+        return false;
+    // clear before checking again, so no notification is lost
+    clear(commands_fd);
+    return queue_pop(&commands, cmd);
+}
+
+void control_respond(struct Command *cmd, char *response) {
+    free(cmd->message);
+    if(!running) {
+        // the thread is gone; in_flight is ours now
+        reply_and_close(cmd->datafd, response);
+        free(response);
+        in_flight--;
+        return;
+    }
+    cmd->message = response;
+    // at most QUEUE_SIZE messages are in flight, so this never fails
+    queue_push(&responses, cmd);
+    notify(responses_fd);
+}
+
+void control_stop(void) {
+    atomic_store(&stopping, true);
+    notify(responses_fd);
+    int err = pthread_join(thread, NULL);
+    if(err) {
+        errno = err;
+        die_perror("pthread_join");
+    }
+    running = false;
+    close(commands_fd);
+    close(responses_fd);
+}
+
+static void *control_main(void *arg) {
+    (void) arg;
+    // not inherited, see priority.h
+    priority_apply_thread();
+    struct pollfd fds[2 + MAX_PENDING];
+    while(true) {
+        // leave further clients in the backlog while all slots are taken
+        fds[0] = (struct pollfd) {.fd = listenfd,
+            .events = n_pending < MAX_PENDING ? POLLIN : 0};
+        fds[1] = (struct pollfd) {.fd = responses_fd, .events = POLLIN};
+        for(unsigned i = 0; i < n_pending; i++)
+            fds[2 + i] = (struct pollfd) {.fd = pending[i].datafd,
+                .events = POLLIN};
+        if(poll(fds, 2 + n_pending, pending_timeout()) < 0) {
+            if(errno == EINTR)
+                continue;
+            die_perror("poll");
+        }
+
+        if(fds[1].revents & POLLIN) {
+            clear(responses_fd);
+            send_responses();
+        }
+
+        // backwards, as a connection done with is replaced by the last one
+        for(unsigned i = n_pending; i-- > 0; )
+            if(fds[2 + i].revents)
+                read_message(i);
+        if(atomic_load(&stopping)) {
+            // the last responses may have come after the wakeup
+            send_responses();
+            // take what has arrived meanwhile, left for the scheduler
+            // to answer; clients not accepted yet wait in the backlog
+            for(unsigned i = n_pending; i-- > 0; )
+                read_message(i);
+            expire_pending(true);
+            return NULL;
+        }
+        expire_pending(false);
+
+        if(fds[0].revents & POLLIN)
+            accept_connection();
+    }
+}
+
+// Accept a client. Its message is read once it arrives.
+static void accept_connection(void) {
+    int datafd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if(datafd == -1) {
+        if(errno == EINTR || errno == ECONNABORTED)
+            return;
+        die_perror("accept4");
+    }
+    struct Pending *p = pending + n_pending++;
+    p->datafd = datafd;
+    clock_gettime(CLOCK_MONOTONIC, &p->deadline);
+    p->deadline.tv_sec += receive_timeout;
+}
+
+/**
+ * Read the message of pending[i] if it has arrived,
+ * and pass it to the scheduler.
+ */
+static void read_message(unsigned i) {
+    int datafd = pending[i].datafd;
+    char inmsg[1024];
+    ssize_t sz = read(datafd, inmsg, sizeof(inmsg) - 1);
+    if(sz < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    remove_pending(i);
+    if(sz < 0) {
+        // a misbehaving client only affects itself
+        close(datafd);
+        return;
+    }
+    inmsg[sz] = '\0';
+    handle_message(datafd, inmsg);
+}
+
+// Milliseconds until the first pending connection expires, -1 if none.
+static int pending_timeout(void) {
+    if(n_pending == 0)
+        return -1;
+    struct timespec cur;
+    clock_gettime(CLOCK_MONOTONIC, &cur);
+    long long ms = 1000LL * 1000;
+    for(unsigned i = 0; i < n_pending; i++) {
+        long long left = (pending[i].deadline.tv_sec - cur.tv_sec) * 1000LL +
+            (pending[i].deadline.tv_nsec - cur.tv_nsec + 999999) / 1000000;
+        if(left < ms)
+            ms = left;
+    }
+    return ms < 0 ? 0 : ms;
+}
+
+/**
+ * Give up the connections past their deadline, or all of them.
+ * Their clients see the connection closed without a response.
+ */
+static void expire_pending(bool all) {
+    struct timespec cur;
+    clock_gettime(CLOCK_MONOTONIC, &cur);
+    for(unsigned i = n_pending; i-- > 0; ) {
+        struct timespec d = pending[i].deadline;
+        if(all || d.tv_sec < cur.tv_sec ||
+                (d.tv_sec == cur.tv_sec && d.tv_nsec <= cur.tv_nsec)) {
+            close(pending[i].datafd);
+            remove_pending(i);
+        }
+    }
+}
+
+static void remove_pending(unsigned i) {
+    pending[i] = pending[--n_pending];
+}
+
+/**
+ * Pass the message read from datafd to the scheduler.
+ */
+static void handle_message(int datafd, const char *message) {
+    struct Command cmd = {datafd, strdup(message)};
+    if(!cmd.message)
+        die_perror("strdup");
+    if(in_flight == QUEUE_SIZE) {
+        free(cmd.message);
+        reply_and_close(datafd, "Too many pending messages. Try again later.");
+        return;
+    }
+    in_flight++;
+    queue_push(&commands, &cmd);
+    notify(commands_fd);
+}
+
+static void send_responses(void) {
+    struct Command cmd;
+    while(queue_pop(&responses, &cmd)) {
+        reply_and_close(cmd.datafd, cmd.message);
+        free(cmd.message);
+        in_flight--;
+    }
+}
+
+/**
+ * Send the response without blocking.
+ * If the client does not have room for it, it just loses the response.
+ */
+static void reply_and_close(int datafd, const char *response) {
+    send(datafd, response, strlen(response),
+            MSG_EOR | MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(datafd);
+}
+
+// Returns false if the queue is full.
+static bool queue_push(struct Queue *queue, const struct Command *cmd) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if(head - tail == QUEUE_SIZE)
+        return false;
+    queue->slots[head % QUEUE_SIZE] = *cmd;
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+// Returns false if the queue is empty.
+static bool queue_pop(struct Queue *queue, struct Command *cmd) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if(head == tail)
+        return false;
+    *cmd = queue->slots[tail % QUEUE_SIZE];
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+// Wake up whoever is waiting on the eventfd.
+static void notify(int fd) {
+    uint64_t one = 1;
+    if(write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        die_perror("write");
+}
+// Reset the eventfd.
+static void clear(int fd) {
+    uint64_t value;
+    if(read(fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        die_perror("read");
+}
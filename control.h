@@ -0,0 +1,70 @@
+/*
+ * control.h - serve the control socket on a dedicated thread
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JAUTOLOCK_CONTROL_H
+#define JAUTOLOCK_CONTROL_H
+#include <stdbool.h>
+/**
+ * A message received from a client.
+ * datafd: connection the response should be sent to
+ * message: the message, or the response when passed back
+ */
+struct Command {
+    int datafd;
+    char *message;
+};
+/**
+ * Get the listening socket passed by a service manager
+ * (e.g. systemd socket activation) through the LISTEN_FDS protocol,
+ * and clear the variables of the protocol.
+ *
+ * Returns -1 if there is none.
+ */
+int control_activated_socket(void);
+/**
+ * Start a thread that accepts connections on the listening socket connfd
+ * and reads messages from them.
+ *
+ * Returns an eventfd that becomes readable when messages are pending.
+ * May be called again after control_stop.
+ */
+int control_start(int connfd);
+/**
+ * Take a pending message without blocking.
+ * Returns false if there is none.
+ *
+ * Every message taken must be answered with control_respond.
+ * After control_stop, the messages left over can still be taken.
+ */
+bool control_receive(struct Command *cmd);
+/**
+ * Send response (a free()-able string) back for cmd without blocking.
+ * Takes ownership of response.
+ * After control_stop, it is sent right away from the calling thread.
+ */
+void control_respond(struct Command *cmd, char *response);
+/**
+ * Send the responses still pending and stop the thread.
+ *
+ * Messages already read are kept: take and answer them with
+ * control_receive and control_respond, so none is lost
+ * (e.g. across a reexec). Connections not accepted yet stay in the
+ * backlog of the listening socket.
+ */
+void control_stop(void);
+#endif // JAUTOLOCK_CONTROL_H
@@ -0,0 +1,196 @@
+/*
+ * daemon.c - the main loop of jautolock
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "daemon.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "cgroup.h"
+#include "control.h"
+#include "die.h"
+#include "loop.h"
+#include "messages.h"
+#include "output.h"
+#include "power.h"
+#include "reexec.h"
+#include "tasks.h"
+#include "timecalc.h"
+#include "trace.h"
+#include "watchdog.h"
+
+static void read_sigchld(int sigfd);
+static bool handle_commands(struct Task *tasks, unsigned n_task);
+static void stop_control(int ctlfd, struct Task *tasks, unsigned n_task);
+
+// the signal that asked to stop, or -1 for an "exit" message
+static volatile sig_atomic_t stop_requested = 0;
+
+int daemon_signalfd(void) {
+    sigset_t mask;
+    if(sigemptyset(&mask) < 0)
+        die_perror("sigemptyset");
+    if(sigaddset(&mask, SIGCHLD) < 0)
+        die_perror("sigaddset");
+    if(sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        die_perror("sigprocmask");
+    int fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if(fd < 0)
+        die_perror("signalfd");
+    return fd;
+}
+
+int daemon_run(struct Daemon *daemon) {
+    struct Task *tasks = daemon->tasks;
+    unsigned n_task = daemon->n_task;
+    int sigfd = daemon->sigfd;
+    int ctlfd = control_start(daemon->connfd);
+    // sigfd, ctlfd, power supplies, then the output of running tasks
+    int *fds = malloc((n_task + 4) * sizeof(int));
+    bool *ready = malloc((n_task + 4) * sizeof(bool));
+    if(!fds || !ready)
+        die_perror("malloc");
+
+    bool reexec_requested = false;
+    while(!stop_requested) {
+        watch_beat();
+        struct timespec timeout;
+        timecalc_cycle(&timeout, tasks, n_task);
+        if(daemon->cycled)
+            daemon->cycled(daemon, &timeout);
+
+        unsigned n_fd = 0;
+        fds[n_fd++] = sigfd;
+        fds[n_fd++] = ctlfd;
+        unsigned n_power = power_fds(fds + n_fd);
+        n_fd += n_power;
+        for(unsigned i = 0; i < n_task; i++)
+            if(tasks[i].outfd >= 0)
+                fds[n_fd++] = tasks[i].outfd;
+
+        watch_phase(WATCH_WAIT);
+        if(!loop_wait(fds, ready, n_fd, timeout))
+            continue;
+
+        watch_beat();
+        watch_phase(WATCH_OUTPUT);
+        for(unsigned i = 0, j = 2 + n_power; i < n_task; i++)
+            if(tasks[i].outfd >= 0 && ready[j++])
+                output_drain(tasks + i);
+
+        bool power_ready = false;
+        for(unsigned i = 2; i < 2 + n_power; i++)
+            power_ready |= ready[i];
+        if(power_ready) {
+            watch_phase(WATCH_POWER);
+            // a task may be fired, or no longer, from now on
+            power_update(tasks, n_task);
+        }
+
+        if(ready[0]) {
+            watch_phase(WATCH_REAP);
+            read_sigchld(sigfd);
+            // several children may be reported by one signal
+            pid_t pid;
+            while((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+                trace(TRACE_REAP, pid);
+                for(unsigned i = 0; i < n_task; i++)
+                    if(tasks[i].pid == pid) {
+                        tasks[i].pid = 0;
+                        cgroup_collect(tasks + i);
+                    } else if(tasks[i].warm_pid == pid) {
+                        // died before being released; the task is
+                        // forked as usual at the deadline
+                        discard_prewarm(tasks + i);
+                    }
+            }
+            if(pid < 0 && errno != ECHILD)
+                die_perror("waitpid");
+        }
+
+        if(ready[1]) {
+            watch_phase(WATCH_MESSAGE);
+            reexec_requested |= handle_commands(tasks, n_task);
+        }
+
+        if(reexec_requested) {
+            watch_phase(WATCH_MESSAGE);
+            reexec_requested = false;
+            stop_control(ctlfd, tasks, n_task);
+            // unless an "exit" was among the last messages
+            if(!stop_requested)
+                reexec(daemon->argv, daemon->connfd, daemon->own_socket,
+                        sigfd, tasks, n_task);
+            ctlfd = control_start(daemon->connfd);
+        }
+    }
+
+    stop_control(ctlfd, tasks, n_task);
+    free(fds);
+    free(ready);
+    int sig = stop_requested > 0 ? stop_requested : 0;
+    stop_requested = 0;
+    return sig;
+}
+
+void daemon_stop(int sig) {
+    stop_requested = sig ? sig : -1;
+}
+
+// Answer the messages pending. Returns whether a reexec is asked for.
+static bool handle_commands(struct Task *tasks, unsigned n_task) {
+    bool reexec_requested = false;
+    struct Command cmd;
+    while(control_receive(&cmd)) {
+        trace(TRACE_MESSAGE, strlen(cmd.message));
+        if(strcmp(cmd.message, "exit") == 0)
+            stop_requested = -1;
+        if(strcmp(cmd.message, "reexec") == 0)
+            reexec_requested = true;
+        control_respond(&cmd, handle_messages(cmd.message, tasks, n_task));
+    }
+    return reexec_requested;
+}
+
+// Stop the control thread, and answer the messages it read meanwhile,
+// so no client is left without a response.
+static void stop_control(int ctlfd, struct Task *tasks, unsigned n_task) {
+    loop_forget(ctlfd);
+    control_stop();
+    // already on the way out
+    handle_commands(tasks, n_task);
+}
+
+/**
+ * Read a signal from the specified file descripter.
+ * The signal read must be SIGCHLD.
+ *
+ * The caller should then wait() for dead children.
+ */
+static void read_sigchld(int sigfd) {
+    struct signalfd_siginfo siginfo;
+    if(read(sigfd, &siginfo, sizeof(siginfo)) < 0)
+        die_perror("read");
+    if(siginfo.ssi_signo != SIGCHLD)
+        die("SIGCHLD expected, not %s\n", strsignal(siginfo.ssi_signo));
+}
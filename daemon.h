@@ -0,0 +1,65 @@
+/*
+ * daemon.h - the main loop of jautolock
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JAUTOLOCK_DAEMON_H
+#define JAUTOLOCK_DAEMON_H
+#include <stdbool.h>
+#include <time.h>
+/**
+ * Forward declaration. See "tasks.h".
+ */
+struct Task;
+/**
+ * What the main loop runs.
+ * sigfd: from daemon_signalfd()
+ * connfd: the listening control socket
+ * own_socket: whether connfd is bound by jautolock itself
+ * argv: the command line to restart with on "reexec"
+ * cycled: if not NULL, called after every cycle of timecalc with the
+ *         time about to be slept, which it may shorten (for benchmarks)
+ */
+struct Daemon {
+    struct Task *tasks;
+    unsigned n_task;
+    int sigfd;
+    int connfd;
+    bool own_socket;
+    char **argv;
+    void (*cycled)(struct Daemon *daemon, struct timespec *timeout);
+};
+/**
+ * Block SIGCHLD and return a signalfd that receives it.
+ */
+int daemon_signalfd(void);
+/**
+ * Serve the control socket, fire tasks and reap them until
+ * daemon_stop is called or an "exit" message is received.
+ *
+ * timecalc, the event loop and the watchdog must be set up.
+ * The control thread is started and stopped here.
+ *
+ * Returns the signal passed to daemon_stop, 0 if none.
+ */
+int daemon_run(struct Daemon *daemon);
+/**
+ * Make daemon_run return after the current cycle.
+ * sig is the signal that asks for it, or 0.
+ * Safe to call from a signal handler.
+ */
+void daemon_stop(int sig);
+#endif // JAUTOLOCK_DAEMON_H
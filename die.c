@@ -20,16 +20,19 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "trace.h"
 _Noreturn void die(const char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
     vfprintf(stderr, fmt, ap);
     va_end(ap);
 
+    trace_flush();
     exit(EXIT_FAILURE);
 }
 _Noreturn void die_perror(const char *s) {
     perror(s);
 
+    trace_flush();
     exit(EXIT_FAILURE);
 }
@@ -19,12 +19,14 @@
 #ifndef JAUTOLOCK_DIE_H
 #define JAUTOLOCK_DIE_H
 /**
- * Print error message to stderr and exit(EXIT_FAILURE).
+ * Print error message to stderr, write out the trace (see "trace.h")
+ * and exit(EXIT_FAILURE).
  * (fprintf version)
  */
 _Noreturn void die(const char *fmt, ...);
 /**
- * Print error message to stderr and exit(EXIT_FAILURE).
+ * Print error message to stderr, write out the trace (see "trace.h")
+ * and exit(EXIT_FAILURE).
  * (perror version)
  */
 _Noreturn void die_perror(const char *s);
@@ -0,0 +1,30 @@
+/*
+ * idle.h - get user idle time from X
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JAUTOLOCK_IDLE_H
+#define JAUTOLOCK_IDLE_H
+#include <time.h>
+/**
+ * Get user idle time using the X screen saver extension.
+ *
+ * There are two implementations: idle_x11.c (Xlib) and idle_xcb.c
+ * (xcb, smaller footprint). The Makefile picks one.
+ * The connection to X is opened on first use and kept.
+ */
+struct timespec get_idle_time(void);
+#endif // JAUTOLOCK_IDLE_H
@@ -0,0 +1,46 @@
+/*
+ * idle_x11.c - get user idle time from X using Xlib
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "idle.h"
+#include <X11/Xlib.h>
+#include <X11/extensions/scrnsaver.h>
+#include <time.h>
+#include "die.h"
+
+// kept open, so each query is a single round trip
+static Display *display;
+static XScreenSaverInfo *info;
+
+struct timespec get_idle_time(void) {
+    if(!display) {
+        display = XOpenDisplay(NULL);
+        if(!display)
+            die("Cannot open display.\n");
+        info = XScreenSaverAllocInfo();
+        if(!info)
+            die("Cannot allocate XScreenSaverInfo.\n");
+    }
+    // losing the connection is fatal in Xlib, as opening it again was
+    if(!XScreenSaverQueryInfo(display, XDefaultRootWindow(display), info))
+        die("X screen saver extension not supported.\n");
+
+    struct timespec idle;
+    idle.tv_sec  = info->idle / 1000,
+    idle.tv_nsec = info->idle % 1000 * 1000000;
+    return idle;
+}
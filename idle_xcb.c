@@ -0,0 +1,71 @@
+/*
+ * idle_xcb.c - get user idle time from X using xcb
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "idle.h"
+#include <stdlib.h>
+#include <time.h>
+#include <xcb/screensaver.h>
+#include <xcb/xcb.h>
+#include "die.h"
+
+static void connect_display(void);
+
+// kept open, so each query is a single round trip
+static xcb_connection_t *conn;
+static xcb_window_t root;
+
+struct timespec get_idle_time(void) {
+    if(!conn)
+        connect_display();
+
+    xcb_screensaver_query_info_reply_t *info =
+        xcb_screensaver_query_info_reply(conn,
+                xcb_screensaver_query_info(conn, root), NULL);
+    if(!info && xcb_connection_has_error(conn)) {
+        // e.g. the X server restarted; try once more
+        xcb_disconnect(conn);
+        connect_display();
+        info = xcb_screensaver_query_info_reply(conn,
+                xcb_screensaver_query_info(conn, root), NULL);
+    }
+    if(!info)
+        die("Cannot query X screen saver extension.\n");
+
+    struct timespec idle;
+    idle.tv_sec  = info->ms_since_user_input / 1000,
+    idle.tv_nsec = info->ms_since_user_input % 1000 * 1000000;
+
+    free(info);
+    return idle;
+}
+
+static void connect_display(void) {
+    int screen_num;
+    conn = xcb_connect(NULL, &screen_num);
+    if(xcb_connection_has_error(conn))
+        die("Cannot open display.\n");
+    const xcb_query_extension_reply_t *ext =
+        xcb_get_extension_data(conn, &xcb_screensaver_id);
+    if(!ext || !ext->present)
+        die("X screen saver extension not supported.\n");
+
+    xcb_screen_iterator_t iter = xcb_setup_roots_iterator(xcb_get_setup(conn));
+    for(int i = 0; i < screen_num; i++)
+        xcb_screen_next(&iter);
+    root = iter.data->root;
+}
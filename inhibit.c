@@ -0,0 +1,74 @@
+/*
+ * inhibit.c - recurring windows during which user is assumed busy
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "inhibit.h"
+#include <stdbool.h>
+#include <time.h>
+#include "die.h"
+
+static time_t day_time(const struct tm *today, int day, int sec);
+
+bool inhibit_active(const struct Inhibit *inhibits, unsigned n,
+        time_t now, time_t *next_edge) {
+    if(n == 0)
+        return false;
+
+    struct tm today;
+    if(!localtime_r(&now, &today))
+        die_perror("localtime_r");
+
+    bool active = false;
+    time_t edge = now + 8 * 86400;
+    // a window started yesterday may still be in effect
+    for(int day = -1; day <= 7; day++) {
+        int wday = ((today.tm_wday + day) % 7 + 7) % 7;
+        for(unsigned i = 0; i < n; i++) {
+            if(!(inhibits[i].days & (1u << wday)))
+                continue;
+            time_t start = day_time(&today, day, inhibits[i].from);
+            time_t end = day_time(&today,
+                    day + (inhibits[i].until <= inhibits[i].from),
+                    inhibits[i].until);
+            if(start <= now && now < end)
+                active = true;
+            if(start > now && start < edge)
+                edge = start;
+            if(end > now && end < edge)
+                edge = end;
+        }
+    }
+    *next_edge = edge;
+    return active;
+}
+
+/**
+ * Local time sec seconds after the midnight
+ * that is day days after today.
+ */
+static time_t day_time(const struct tm *today, int day, int sec) {
+    struct tm tm = *today;
+    tm.tm_mday += day;
+    tm.tm_hour = sec / 3600;
+    tm.tm_min = sec / 60 % 60;
+    tm.tm_sec = sec % 60;
+    tm.tm_isdst = -1;
+    time_t t = mktime(&tm);
+    if(t == (time_t) -1)
+        die("Cannot represent inhibit window in local time.\n");
+    return t;
+}
@@ -0,0 +1,44 @@
+/*
+ * inhibit.h - recurring windows during which user is assumed busy
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JAUTOLOCK_INHIBIT_H
+#define JAUTOLOCK_INHIBIT_H
+#include <stdbool.h>
+#include <time.h>
+/**
+ * A recurring inhibit window, in local time.
+ * days: bitmask of weekdays the window starts on (bit 0 is Sunday)
+ * from: start of the window, in seconds since midnight
+ * until: end of the window, in seconds since midnight
+ *        if not after from, the window ends on the next day
+ */
+struct Inhibit {
+    unsigned days;
+    int from;
+    int until;
+};
+/**
+ * Check whether any of the windows is in effect at time now.
+ *
+ * The earliest time after now at which the answer may change
+ * is put in *next_edge.
+ * If no window is defined, *next_edge is left untouched.
+ */
+bool inhibit_active(const struct Inhibit *inhibits, unsigned n,
+        time_t now, time_t *next_edge);
+#endif // JAUTOLOCK_INHIBIT_H
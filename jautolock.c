@@ -19,45 +19,52 @@
 #include <confuse.h>
 #include <errno.h>
 #include <getopt.h>
+#include <malloc.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
 #include <sys/socket.h>
-#include <sys/signalfd.h>
 #include <sys/un.h>
-#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
+#include "cgroup.h"
+#include "control.h"
+#include "daemon.h"
 #include "die.h"
-#include "messages.h"
+#include "inhibit.h"
+#include "loop.h"
+#include "power.h"
+#include "priority.h"
+#include "reexec.h"
 #include "tasks.h"
 #include "timecalc.h"
 #include "userconfig.h"
+#include "watchdog.h"
 
 static char *get_socket_path(void);
 static char *intersperse(char **list, int n);
 static char *send_message(const char *msg, const char *socket_path);
-static int mask_and_signalfd(int signum);
+static int bind_socket(const char *socket_path);
+static struct sockaddr_un socket_address(const char *socket_path);
 static void signal_handler(int sig);
-static pid_t get_dead_child_pid(int sigfd);
 
 static struct option long_options[] = {
     {"config", required_argument, 0, 'c'},
     {"help", no_argument, 0, 'h'},
+    {"loop", required_argument, 0, 'l'},
     {0, 0, 0, 0}
 };
 
-static sig_atomic_t exit_on_signal = 0;
-
 int main(int argc, char **argv) {
     char *config_file = NULL;
     char *socket_path = NULL;
+    enum LoopBackend backend = LOOP_SELECT;
     while(true) {
         int option_index = 0;
-        int opt = getopt_long(argc, argv, "c:h", long_options, &option_index);
+        int opt = getopt_long(argc, argv, "c:hl:", long_options, &option_index);
         if(opt == -1)
             break;
         switch(opt) {
@@ -68,9 +75,13 @@ int main(int argc, char **argv) {
             if(!config_file)
                 die_perror("strdup");
             break;
+        case 'l':
+            if(loop_parse(optarg, &backend) < 0)
+                die("Unknown event loop %s, use select or io_uring.\n", optarg);
+            break;
         case 'h':
             printf("jautolock © 2017 Pochang Chen\n"
-                   "Usage: %s [-c <configfile>] [-h] [<message>]\n", argv[0]);
+                   "Usage: %s [-c <configfile>] [-l select|io_uring] [-h] [<message>]\n", argv[0]);
             return 0;
         }
     }
@@ -97,83 +108,80 @@ int main(int argc, char **argv) {
     if(n_task == 0)
         die("No task specifed in configuration.\n");
 
-    int sigfd = mask_and_signalfd(SIGCHLD);
+    struct Inhibit *inhibits;
+    unsigned n_inhibit = get_inhibits(config, &inhibits);
+    struct timespec poll_max, cycle_budget;
+    parse_time(cfg_getstr(config, "poll_max"), &poll_max);
+    parse_time(cfg_getstr(config, "cycle_budget"), &cycle_budget);
+    char *power_supply_dir = strdup(cfg_getstr(config, "power_supply_dir"));
+    if(!power_supply_dir)
+        die_perror("strdup");
+    struct Priority priority = {
+        .lock_memory = cfg_getbool(config, "lock_memory"),
+        .priority = cfg_getint(config, "sched_priority"),
+        .nice = cfg_getint(config, "nice"),
+    };
+    priority_parse_policy(cfg_getstr(config, "sched_policy"), &priority.policy);
+    // nothing refers to config any more; don't keep it resident
+    cfg_free(config);
+    // one malloc arena is plenty for two threads this light
+    mallopt(M_ARENA_MAX, 1);
 
     {
         struct sigaction act = {0};
         act.sa_handler = signal_handler;
         sigaction(SIGINT, &act, NULL);
         sigaction(SIGTERM, &act, NULL);
+        // a prewarmed child that died is found by writing to its pipe
+        signal(SIGPIPE, SIG_IGN);
     }
 
-    // TODO unlink?
-    int connfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
-    if(connfd == -1)
-        die_perror("socket");
-    {
-        struct sockaddr_un name;
-        memset(&name, 0, sizeof(name));
-        name.sun_family = AF_UNIX;
-        strncpy(name.sun_path, socket_path, sizeof(name.sun_path) - 1);
-        if(bind(connfd, (const struct sockaddr*) &name,
-                   sizeof(struct sockaddr_un)) < 0)
-            die_perror("bind");
-    }
-    if(listen(connfd, 20) < 0)
-        die_perror("listen");
-
     timecalc_init();
+    timecalc_set_inhibits(inhibits, n_inhibit);
+    timecalc_set_poll_max(poll_max);
 
-    while(!exit_on_signal) {
-        struct timespec timeout;
-        timecalc_cycle(&timeout, tasks, n_task);
-
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(sigfd, &readfds);
-        FD_SET(connfd, &readfds);
-
-        if(pselect(FD_SETSIZE, &readfds, NULL, NULL, &timeout, NULL) < 0) {
-            if(errno == EINTR && exit_on_signal)
-                break;
-            die_perror("pselect");
-        }
-
-        if(FD_ISSET(sigfd, &readfds)) {
-            int pid = get_dead_child_pid(sigfd);
-            for(unsigned i = 0; i < n_task; i++)
-                if(tasks[i].pid == pid)
-                    tasks[i].pid = 0;
-        }
-
-        if(FD_ISSET(connfd, &readfds)) {
-            int datafd = accept4(connfd, NULL, NULL, SOCK_CLOEXEC);
-            if(datafd == -1)
-                die_perror("accept4");
-            // TODO IO multiplexing
-            char inmsg[1024];
-            ssize_t sz = read(datafd, inmsg, sizeof(inmsg) - 1);
-            if(sz < 0)
-                die_perror("read");
-            inmsg[sz] = '\0';
-            if(strcmp(inmsg, "exit") == 0)
-                exit_on_signal = -1;
-            char *outmsg = handle_messages(inmsg, tasks, n_task);
-            if(send(datafd, outmsg, strlen(outmsg), MSG_EOR) < 0)
-                die_perror("send");
-            free(outmsg);
-            close(datafd);
-        }
+    int sigfd, connfd;
+    bool own_socket;
+    if(!reexec_restore(&connfd, &own_socket, &sigfd, tasks, n_task)) {
+        sigfd = daemon_signalfd();
+        connfd = control_activated_socket();
+        own_socket = connfd < 0;
+        if(own_socket)
+            connfd = bind_socket(socket_path);
     }
+    // after the state passed by reexec, which it goes on from
+    power_init(power_supply_dir, tasks, n_task);
+    free(power_supply_dir);
+    // before other threads start, as it may move the process
+    cgroup_init(NULL, tasks, n_task, priority.policy == SCHED_FIFO ||
+            priority.policy == SCHED_RR);
+    // before the threads start, which then apply it to themselves
+    priority_apply(&priority);
+
+    loop_init(backend);
+    watchdog_start(cycle_budget);
+    struct Daemon daemon = {
+        .tasks = tasks,
+        .n_task = n_task,
+        .sigfd = sigfd,
+        .connfd = connfd,
+        .own_socket = own_socket,
+        .argv = argv,
+    };
+    int sig = daemon_run(&daemon);
+    cgroup_cleanup(tasks, n_task);
 
     close(connfd);
-    unlink(socket_path);
+    // a socket passed by the service manager is its business
+    if(own_socket)
+        unlink(socket_path);
     free(socket_path);
+    for(unsigned i = 0; i < n_task; i++)
+        free(tasks[i].log.data);
     free(tasks);
-    cfg_free(config);
+    free(inhibits);
 
-    if(exit_on_signal > 0) {
-        int sig = exit_on_signal;
+    if(sig) {
         signal(sig, SIG_DFL);
         raise(sig);
     }
@@ -210,70 +218,86 @@ static char *send_message(const char *outmsg, const char *socket_path) {
     if(datafd == -1)
         die_perror("socket");
 
-    struct sockaddr_un name;
-    memset(&name, 0, sizeof(name));
-    name.sun_family = AF_UNIX;
-    strncpy(name.sun_path, socket_path, sizeof(name.sun_path) - 1);
-    if(connect(datafd, (const struct sockaddr*) &name,
-                sizeof(struct sockaddr_un)) < 0)
-        die_perror("connect");
+    // the daemon may be starting at the same time, so wait a while for it
+    struct sockaddr_un name = socket_address(socket_path);
+    struct timespec delay = {0, 10000000}; // 10ms, doubled each time
+    for(int tries = 0; ; tries++) {
+        if(connect(datafd, (const struct sockaddr*) &name,
+                    sizeof(struct sockaddr_un)) == 0)
+            break;
+        if((errno != ENOENT && errno != ECONNREFUSED) || tries == 7)
+            die_perror("connect");
+        nanosleep(&delay, NULL);
+        delay.tv_nsec *= 2;
+    }
 
     if(send(datafd, outmsg, strlen(outmsg), MSG_EOR) < 0)
         die_perror("send");
 
-    char buf[1024];
-    ssize_t sz = read(datafd, buf, sizeof(buf) - 1);
+    // responses (e.g. to "logs") may be long, so find out the size first
+    ssize_t sz = recv(datafd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+    if(sz < 0)
+        die_perror("recv");
+    char *inmsg = malloc(sz + 1);
+    if(!inmsg)
+        die_perror("malloc");
+    sz = read(datafd, inmsg, sz);
     if(sz < 0)
         die_perror("read");
-    buf[sz] = '\0';
-    char *inmsg = strdup(buf);
+    inmsg[sz] = '\0';
 
     close(datafd);
     return inmsg;
 }
 
 /**
- * Mask the specified signal and open a file
- * descripter to receive the signal.
+ * Bind and listen on socket_path.
+ * If there is a socket left by a dead instance, replace it.
  *
- * Return the file descripter.
+ * Return the socket.
  */
-static int mask_and_signalfd(int signum) {
-    sigset_t mask;
-    if(sigemptyset(&mask) < 0)
-        die_perror("sigemptyset");
-    if(sigaddset(&mask, signum) < 0)
-        die_perror("sigaddset");
-    if(sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
-        die_perror("sigprocmask");
-    int fd = signalfd(-1, &mask, SFD_CLOEXEC);
-    if(fd < 0)
-        die_perror("signalfd");
-    return fd;
+static int bind_socket(const char *socket_path) {
+    int connfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(connfd == -1)
+        die_perror("socket");
+    struct sockaddr_un name = socket_address(socket_path);
+    while(bind(connfd, (const struct sockaddr*) &name,
+                sizeof(struct sockaddr_un)) < 0) {
+        if(errno != EADDRINUSE)
+            die_perror("bind");
+
+        // is anyone listening on it?
+        int probefd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if(probefd == -1)
+            die_perror("socket");
+        int err = connect(probefd, (const struct sockaddr*) &name,
+                sizeof(struct sockaddr_un)) < 0 ? errno : 0;
+        close(probefd);
+        if(err == 0)
+            die("Another jautolock is already running.\n");
+        if(err != ECONNREFUSED)
+            die("bind: %s\n", strerror(EADDRINUSE));
+
+        fprintf(stderr, "Removing stale socket %s\n", socket_path);
+        if(unlink(socket_path) < 0 && errno != ENOENT)
+            die_perror("unlink");
+    }
+    if(listen(connfd, 20) < 0)
+        die_perror("listen");
+    return connfd;
 }
 
-/**
- * Just the signal handler.
- */
-static void signal_handler(int sig) {
-    exit_on_signal = sig;
+static struct sockaddr_un socket_address(const char *socket_path) {
+    struct sockaddr_un name;
+    memset(&name, 0, sizeof(name));
+    name.sun_family = AF_UNIX;
+    strncpy(name.sun_path, socket_path, sizeof(name.sun_path) - 1);
+    return name;
 }
 
 /**
- * Read a signal from the specified file descripter.
- * The signal read must be SIGCHLD.
- *
- * Then, wait() for a dead child.
- * Return the pid of the child.
+ * Just the signal handler.
  */
-static pid_t get_dead_child_pid(int sigfd) {
-    struct signalfd_siginfo siginfo;
-    if(read(sigfd, &siginfo, sizeof(siginfo)) < 0)
-        die_perror("read");
-    if(siginfo.ssi_signo != SIGCHLD)
-        die("SIGCHLD expected, not %s\n", strsignal(siginfo.ssi_signo));
-    pid_t pid = wait(NULL);
-    if(pid < 0)
-        die_perror("wait");
-    return pid;
+static void signal_handler(int sig) {
+    daemon_stop(sig);
 }
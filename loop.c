@@ -0,0 +1,299 @@
+/*
+ * loop.c - wait for the main loop's file descriptors
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "loop.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "die.h"
+
+/**
+ * A one-shot poll submitted to the ring and not completed yet.
+ * tag: user_data of the poll, never reused
+ */
+struct Poll {
+    int fd;
+    uint64_t tag;
+};
+
+static bool select_wait(const int *fds, bool *ready, unsigned n,
+        struct timespec timeout);
+static bool uring_setup(void);
+static bool uring_wait(const int *fds, bool *ready, unsigned n,
+        struct timespec timeout);
+static void uring_cancel(struct Poll *poll);
+static struct io_uring_sqe *uring_get_sqe(void);
+static int uring_enter(unsigned min_complete, unsigned flags,
+        const void *arg, size_t argsz);
+static void uring_reap(const int *fds, bool *ready, unsigned n);
+static struct Poll *find_poll(int fd);
+static bool contains(const int *fds, unsigned n, int fd);
+
+static const unsigned ring_entries = 64;
+
+static enum LoopBackend backend;
+static unsigned long long waits, syscalls;
+
+// the io_uring instance and its shared memory
+static int ring_fd = -1;
+static unsigned *sq_head, *sq_tail, *sq_mask, *cq_head, *cq_tail, *cq_mask;
+static unsigned sq_local_tail;
+static struct io_uring_sqe *sqes;
+static struct io_uring_cqe *cqes;
+// polls in flight
+static struct Poll *polls;
+static unsigned n_poll, polls_size;
+static uint64_t last_tag;
+
+int loop_parse(const char *name, enum LoopBackend *result) {
+    if(strcmp(name, "select") == 0)
+        *result = LOOP_SELECT;
+    else if(strcmp(name, "io_uring") == 0)
+        *result = LOOP_URING;
+    else
+        return -1;
+    return 0;
+}
+
+void loop_init(enum LoopBackend b) {
+    backend = b;
+    if(backend == LOOP_URING && !uring_setup()) {
+        fprintf(stderr, "WARNING: io_uring is not usable, using select\n");
+        backend = LOOP_SELECT;
+    }
+}
+
+bool loop_wait(const int *fds, bool *ready, unsigned n,
+        struct timespec timeout) {
+    waits++;
+    for(unsigned i = 0; i < n; i++)
+        ready[i] = false;
+    if(backend == LOOP_URING)
+        return uring_wait(fds, ready, n, timeout);
+    return select_wait(fds, ready, n, timeout);
+}
+
+void loop_forget(int fd) {
+    struct Poll *poll = find_poll(fd);
+    if(poll)
+        uring_cancel(poll);
+}
+
+const char *loop_stats(unsigned long long *w, unsigned long long *s) {
+    *w = waits;
+    *s = syscalls;
+    return backend == LOOP_URING ? "io_uring" : "select";
+}
+
+static bool select_wait(const int *fds, bool *ready, unsigned n,
+        struct timespec timeout) {
+    fd_set readfds;
+    FD_ZERO(&readfds);
+    for(unsigned i = 0; i < n; i++)
+        FD_SET(fds[i], &readfds);
+
+    syscalls++;
+    if(pselect(FD_SETSIZE, &readfds, NULL, NULL, &timeout, NULL) < 0) {
+        if(errno == EINTR)
+            return false;
+        die_perror("pselect");
+    }
+
+    for(unsigned i = 0; i < n; i++)
+        ready[i] = FD_ISSET(fds[i], &readfds);
+    return true;
+}
+
+/**
+ * Create the ring and map it.
+ * Returns false if the kernel lacks what we need.
+ */
+static bool uring_setup(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, ring_entries, &params);
+    if(fd < 0)
+        return false;
+    // single mmap: 5.4, timeout argument to io_uring_enter: 5.11
+    if(!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+            !(params.features & IORING_FEAT_EXT_ARG)) {
+        close(fd);
+        return false;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t size = sq_size > cq_size ? sq_size : cq_size;
+    char *ring = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(ring == MAP_FAILED)
+        die_perror("mmap");
+    sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED)
+        die_perror("mmap");
+
+    sq_head = (unsigned *) (ring + params.sq_off.head);
+    sq_tail = (unsigned *) (ring + params.sq_off.tail);
+    sq_mask = (unsigned *) (ring + params.sq_off.ring_mask);
+    cq_head = (unsigned *) (ring + params.cq_off.head);
+    cq_tail = (unsigned *) (ring + params.cq_off.tail);
+    cq_mask = (unsigned *) (ring + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) (ring + params.cq_off.cqes);
+    // slot i of the submission queue is always sqes[i]
+    unsigned *array = (unsigned *) (ring + params.sq_off.array);
+    for(unsigned i = 0; i < params.sq_entries; i++)
+        array[i] = i;
+    sq_local_tail = *sq_tail;
+
+    ring_fd = fd;
+    return true;
+}
+
+/**
+ * Keep a one-shot poll in flight for each of fds, and submit
+ * them together with the wait in one io_uring_enter.
+ */
+static bool uring_wait(const int *fds, bool *ready, unsigned n,
+        struct timespec timeout) {
+    // cancel the polls no longer wanted
+    for(unsigned i = 0; i < n_poll; ) {
+        if(contains(fds, n, polls[i].fd))
+            i++;
+        else
+            uring_cancel(polls + i);
+    }
+
+    for(unsigned i = 0; i < n; i++) {
+        if(find_poll(fds[i]))
+            continue;
+        if(n_poll == polls_size) {
+            polls_size = polls_size ? polls_size * 2 : 8;
+            polls = realloc(polls, polls_size * sizeof(struct Poll));
+            if(!polls)
+                die_perror("realloc");
+        }
+        struct io_uring_sqe *sqe = uring_get_sqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fds[i];
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = ++last_tag;
+        polls[n_poll++] = (struct Poll) {fds[i], last_tag};
+    }
+
+    struct __kernel_timespec ts = {timeout.tv_sec, timeout.tv_nsec};
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uintptr_t) &ts;
+    if(uring_enter(1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                &arg, sizeof(arg)) < 0) {
+        if(errno == EINTR)
+            return false;
+        if(errno != ETIME)
+            die_perror("io_uring_enter");
+    }
+
+    uring_reap(fds, ready, n);
+    return true;
+}
+
+/**
+ * Queue the removal of the poll, to be submitted with the next wait.
+ * It is no longer in flight as far as we are concerned,
+ * so a new descriptor with the same number gets its own poll.
+ */
+static void uring_cancel(struct Poll *poll) {
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = poll->tag;
+    *poll = polls[--n_poll];
+}
+
+// Get a free submission queue entry, submitting the queue if it is full.
+static struct io_uring_sqe *uring_get_sqe(void) {
+    while(sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >
+            *sq_mask) {
+        if(uring_enter(0, 0, NULL, 0) < 0 && errno != EINTR)
+            die_perror("io_uring_enter");
+    }
+    struct io_uring_sqe *sqe = sqes + (sq_local_tail & *sq_mask);
+    memset(sqe, 0, sizeof(*sqe));
+    sq_local_tail++;
+    return sqe;
+}
+
+// Submit everything queued so far, and wait for min_complete completions.
+static int uring_enter(unsigned min_complete, unsigned flags,
+        const void *arg, size_t argsz) {
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit =
+        sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    syscalls++;
+    return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+            flags, arg, argsz);
+}
+
+/**
+ * Consume the completion queue. The polls completed
+ * mark their descriptors ready and are no longer in flight.
+ */
+static void uring_reap(const int *fds, bool *ready, unsigned n) {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for(; head != tail; head++) {
+        // cancelled polls and the cancellations themselves are not found
+        struct Poll *poll = NULL;
+        uint64_t tag = cqes[head & *cq_mask].user_data;
+        for(unsigned i = 0; i < n_poll; i++)
+            if(polls[i].tag == tag)
+                poll = polls + i;
+        if(!poll)
+            continue;
+        // like select, errors also count as ready
+        for(unsigned i = 0; i < n; i++)
+            if(fds[i] == poll->fd)
+                ready[i] = true;
+        *poll = polls[--n_poll];
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+static struct Poll *find_poll(int fd) {
+    for(unsigned i = 0; i < n_poll; i++)
+        if(polls[i].fd == fd)
+            return polls + i;
+    return NULL;
+}
+
+static bool contains(const int *fds, unsigned n, int fd) {
+    for(unsigned i = 0; i < n; i++)
+        if(fds[i] == fd)
+            return true;
+    return false;
+}
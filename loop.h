@@ -0,0 +1,58 @@
+/*
+ * loop.h - wait for the main loop's file descriptors
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JAUTOLOCK_LOOP_H
+#define JAUTOLOCK_LOOP_H
+#include <stdbool.h>
+#include <time.h>
+enum LoopBackend {
+    LOOP_SELECT,
+    LOOP_URING,
+};
+/**
+ * Parse the name of a backend ("select" or "io_uring").
+ * Returns 0 on success and -1 on failure.
+ */
+int loop_parse(const char *name, enum LoopBackend *backend);
+/**
+ * Set up the specified backend.
+ * Falls back to select with a warning if io_uring is not usable.
+ */
+void loop_init(enum LoopBackend backend);
+/**
+ * Wait until any of fds[0] to fds[n - 1] is readable,
+ * or timeout has passed. ready[i] is set to whether fds[i] is.
+ *
+ * A descriptor waited for must be passed to loop_forget()
+ * before it is closed.
+ *
+ * Returns false if interrupted by a signal.
+ */
+bool loop_wait(const int *fds, bool *ready, unsigned n,
+        struct timespec timeout);
+/**
+ * Stop waiting for fd, which is about to be closed.
+ */
+void loop_forget(int fd);
+/**
+ * Name of the backend in use, and the number of waits
+ * and system calls made by it so far.
+ */
+const char *loop_stats(unsigned long long *waits,
+        unsigned long long *syscalls);
+#endif // JAUTOLOCK_LOOP_H
@@ -18,17 +18,30 @@
  */
 #include "messages.h"
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include "cgroup.h"
 #include "die.h"
+#include "loop.h"
+#include "output.h"
 #include "tasks.h"
 #include "timecalc.h"
+#include "trace.h"
+#include "userconfig.h"
+#include "watchdog.h"
 
 static char *strjoin(char *first, const char *second);
 static char *handle_now(char *arg, struct Task *tasks, unsigned n);
 static char *handle_busy(char *arg, struct Task *tasks, unsigned n);
 static char *handle_unbusy(char *arg, struct Task *tasks, unsigned n);
 static char *handle_exit(char *arg, struct Task *tasks, unsigned n);
+static char *handle_logs(char *arg, struct Task *tasks, unsigned n);
+static char *handle_trace(char *arg, struct Task *tasks, unsigned n);
+static char *handle_stats(char *arg, struct Task *tasks, unsigned n);
+static char *handle_reexec(char *arg, struct Task *tasks, unsigned n);
+static char *handle_usage(char *arg, struct Task *tasks, unsigned n);
 
 struct {
     const char *const command;
@@ -38,6 +51,11 @@ struct {
     {"busy", handle_busy},
     {"unbusy", handle_unbusy},
     {"exit", handle_exit},
+    {"logs", handle_logs},
+    {"trace", handle_trace},
+    {"stats", handle_stats},
+    {"reexec", handle_reexec},
+    {"usage", handle_usage},
 };
 
 char *handle_messages(const char *cmessage, struct Task *tasks, unsigned n) {
@@ -73,6 +91,22 @@ char *handle_messages(const char *cmessage, struct Task *tasks, unsigned n) {
     return response;
 }
 
+long read_proc_kb(const char *path, const char *key) {
+    FILE *f = fopen(path, "re");
+    if(!f)
+        return -1;
+    long kb = -1;
+    char line[256];
+    size_t len = strlen(key);
+    while(fgets(line, sizeof(line), f))
+        if(strncmp(line, key, len) == 0) {
+            kb = strtol(line + len, NULL, 10);
+            break;
+        }
+    fclose(f);
+    return kb;
+}
+
 /**
  * strjoin s t = s ++ "\n" ++ t
  *
@@ -90,6 +124,7 @@ static char *strjoin(char *first, const char *second) {
 
 /**
  * Execute the task specified in arg immediately.
+ * See timecalc_fire.
  */
 static char *handle_now(char *arg, struct Task *tasks, unsigned n) {
     if(!*arg)
@@ -101,7 +136,7 @@ static char *handle_now(char *arg, struct Task *tasks, unsigned n) {
             matched = true;
             if(tasks[i].pid == 0) {
                 fired = true;
-                execute_task(tasks + i);
+                timecalc_fire(tasks + i);
             }
         }
     if(!matched)
@@ -112,12 +147,22 @@ static char *handle_now(char *arg, struct Task *tasks, unsigned n) {
 }
 
 /**
- * See timecalc_set_busy.
+ * See timecalc_set_busy and timecalc_set_busy_for.
  */
 static char *handle_busy(char *arg, struct Task *tasks, unsigned n) {
-    (void) arg, (void) tasks, (void) n;
-    timecalc_set_busy(true);
-    return strdup("You're assumed to be busy.");
+    (void) tasks, (void) n;
+    if(!*arg) {
+        timecalc_set_busy(true);
+        return strdup("You're assumed to be busy.");
+    }
+    struct timespec duration;
+    if(parse_time(arg, &duration) < 0 || duration.tv_sec < 0)
+        return strdup("\"busy\" expect no argument or a duration.");
+    timecalc_set_busy_for(duration);
+    char *s;
+    if(asprintf(&s, "You're assumed to be busy for %s.", arg) < 0)
+        die_perror("asprintf");
+    return s;
 }
 static char *handle_unbusy(char *arg, struct Task *tasks, unsigned n) {
     (void) arg, (void) tasks, (void) n;
@@ -132,3 +177,81 @@ static char *handle_exit(char *arg, struct Task *tasks, unsigned n) {
         return strdup("\"exit\" expect no argument.");
     return strdup("Will exit.");
 }
+// Just say "OK, I'll restart"
+static char *handle_reexec(char *arg, struct Task *tasks, unsigned n) {
+    (void) arg, (void) tasks, (void) n;
+    if(*arg)
+        return strdup("\"reexec\" expect no argument.");
+    return strdup("Will restart.");
+}
+
+/**
+ * Show the captured output of the task specified in arg.
+ */
+static char *handle_logs(char *arg, struct Task *tasks, unsigned n) {
+    if(!*arg)
+        return strdup("\"logs\" expect one argument.");
+    for(unsigned i = 0; i < n; i++)
+        if(strcmp(tasks[i].name, arg) == 0) {
+            if(tasks[i].log.size == 0)
+                return strdup("Output of the task is not kept.");
+            // make sure the latest output is included
+            output_drain(tasks + i);
+            return output_get(tasks + i);
+        }
+    return strdup("No task has such name.");
+}
+
+/**
+ * Show the last events recorded (64 unless specified in arg).
+ */
+static char *handle_trace(char *arg, struct Task *tasks, unsigned n) {
+    (void) tasks, (void) n;
+    unsigned long count = 64;
+    if(*arg) {
+        char *ep;
+        count = strtoul(arg, &ep, 10);
+        if(*ep || count == 0)
+            return strdup("\"trace\" expect no argument or a count.");
+    }
+    // keep the response within the size of a message
+    if(count > 1024)
+        count = 1024;
+    char *s = trace_dump(count);
+    if(!s)
+        die_perror("trace_dump");
+    return s;
+}
+
+/**
+ * Show resource usage of jautolock itself.
+ */
+static char *handle_stats(char *arg, struct Task *tasks, unsigned n) {
+    (void) tasks, (void) n;
+    if(*arg)
+        return strdup("\"stats\" expect no argument.");
+    unsigned long long waits, syscalls;
+    const char *loop = loop_stats(&waits, &syscalls);
+    unsigned long long made, avoided;
+    timecalc_get_samples(&made, &avoided);
+    char *s;
+    if(asprintf(&s, "Resident: %ld KiB\nPrivate dirty: %ld KiB\n"
+                "Event loop: %s, %llu waits in %llu system calls\n"
+                "Idle time queries: %llu made, %llu avoided\n"
+                "Stalls of the main loop: %llu",
+                read_proc_kb("/proc/self/status", "VmRSS:"),
+                read_proc_kb("/proc/self/smaps_rollup", "Private_Dirty:"),
+                loop, waits, syscalls, made, avoided,
+                watchdog_stalls()) < 0)
+        die_perror("asprintf");
+    return s;
+}
+
+/**
+ * Show resource usage of the tasks running in cgroups.
+ */
+static char *handle_usage(char *arg, struct Task *tasks, unsigned n) {
+    if(*arg)
+        return strdup("\"usage\" expect no argument.");
+    return cgroup_usage(tasks, n);
+}
@@ -21,11 +21,17 @@
 struct Task;
 /**
  * Handle messages send by the users.
- * Does not actually exit upon receiving "exit" message.
- * Caller should check for "exit" message.
+ * Does not actually exit or restart upon receiving "exit" or "reexec"
+ * message. Caller should check for these messages.
  *
  * Returns an appropriate free()-able message,
  * intended to be sent back to user.
  */
 char *handle_messages(const char *message, struct Task *tasks, unsigned n);
+/**
+ * Find the line starting with key in the file (e.g. /proc/self/status),
+ * and return the number (in kB) after it.
+ * Returns -1 if not found.
+ */
+long read_proc_kb(const char *path, const char *key);
 #endif // JAUTOLOCK_MESSAGES_H
@@ -0,0 +1,219 @@
+/*
+ * output.c - capture output of tasks
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "output.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "die.h"
+#include "loop.h"
+#include "tasks.h"
+
+static void alloc_ring(struct Ring *ring);
+static void open_log_file(struct Task *task);
+static bool drain_to_file(struct Task *task);
+static bool read_into_ring(int fd, struct Ring *ring, size_t max);
+static void discard(int fd);
+static void close_output(struct Task *task);
+
+// how much to tee() or splice() at once, and to take from a task
+// per wakeup, so a task writing non-stop does not hold up the main loop
+// (default capacity of a pipe)
+static const size_t chunk_size = 65536;
+// pipe that output is tee()'d to, so it can be both spliced and kept
+static int scratch[2] = {-1, -1};
+
+int output_open(struct Task *task) {
+    if(task->log.size == 0 && !task->log_file)
+        return -1;
+
+    // output left by a previous run (e.g. from its own children)
+    if(task->outfd >= 0) {
+        output_drain(task);
+        close_output(task);
+    }
+
+    alloc_ring(&task->log);
+    if(task->log_file && task->logfd < 0)
+        open_log_file(task);
+
+    int fds[2];
+    if(pipe2(fds, O_CLOEXEC) < 0)
+        die_perror("pipe2");
+    // only our end is non-blocking; the task should not see EAGAIN
+    if(fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0)
+        die_perror("fcntl");
+    task->outfd = fds[0];
+    return fds[1];
+}
+
+void output_drain(struct Task *task) {
+    if(task->outfd < 0)
+        return;
+    // the pipe may be inherited from a previous instance (see reexec.h)
+    alloc_ring(&task->log);
+    if(task->logfd >= 0 && drain_to_file(task))
+        return;
+    if(read_into_ring(task->outfd, &task->log, chunk_size))
+        close_output(task);
+}
+
+char *output_get(const struct Task *task) {
+    const struct Ring *ring = &task->log;
+    size_t len = ring->written < ring->size ? ring->written : ring->size;
+    char *s = malloc(len + 1);
+    if(!s)
+        die_perror("malloc");
+    if(len) {
+        size_t start = (ring->written - len) % ring->size;
+        size_t first = ring->size - start < len ? ring->size - start : len;
+        memcpy(s, ring->data + start, first);
+        memcpy(s + first, ring->data, len - first);
+    }
+    s[len] = '\0';
+    return s;
+}
+
+static void alloc_ring(struct Ring *ring) {
+    if(ring->size && !ring->data) {
+        ring->data = malloc(ring->size);
+        if(!ring->data)
+            die_perror("malloc");
+    }
+}
+
+static void open_log_file(struct Task *task) {
+    // splice() does not support O_APPEND, so seek to the end instead
+    task->logfd = open(task->log_file, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+    if(task->logfd < 0 || lseek(task->logfd, 0, SEEK_END) < 0) {
+        fprintf(stderr, "WARNING: cannot open log file %s: %s\n",
+                task->log_file, strerror(errno));
+        if(task->logfd >= 0)
+            close(task->logfd);
+        task->logfd = -1;
+    }
+}
+
+/**
+ * Move output (at most chunk_size) to the log file without copying it
+ * to user space, keeping a copy in the ring buffer if there is one.
+ *
+ * Returns false if the log file cannot be spliced to,
+ * in which case it is closed and output should be read instead.
+ */
+static bool drain_to_file(struct Task *task) {
+    if(task->log.size && scratch[0] < 0 &&
+            pipe2(scratch, O_CLOEXEC | O_NONBLOCK) < 0)
+        die_perror("pipe2");
+
+    for(size_t left = chunk_size; left; ) {
+        ssize_t n;
+        if(task->log.size) {
+            n = tee(task->outfd, scratch[1], left, SPLICE_F_NONBLOCK);
+            if(n < 0 && errno == EAGAIN)
+                return true;
+            if(n <= 0) {
+                close_output(task);
+                return true;
+            }
+        } else {
+            n = left;
+        }
+
+        ssize_t moved = splice(task->outfd, NULL, task->logfd, NULL, n,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(moved < 0 && errno == EAGAIN) {
+            // or the copy would be taken for later output
+            if(task->log.size)
+                discard(scratch[0]);
+            return true;
+        }
+        if(moved == 0) {
+            close_output(task);
+            return true;
+        }
+        if(moved < 0) {
+            fprintf(stderr, "WARNING: cannot splice to log file %s: %s\n",
+                    task->log_file, strerror(errno));
+            close(task->logfd);
+            task->logfd = -1;
+            // the output is still in the task's pipe
+            if(task->log.size)
+                discard(scratch[0]);
+            return false;
+        }
+        // the part not spliced is still in the task's pipe
+        if(task->log.size) {
+            read_into_ring(scratch[0], &task->log, moved);
+            discard(scratch[0]);
+        }
+        left -= moved;
+    }
+    return true;
+}
+
+/**
+ * Read at most max bytes from non-blocking fd into the ring buffer.
+ * Without a ring buffer, the bytes are discarded.
+ *
+ * Returns true on end of file.
+ */
+static bool read_into_ring(int fd, struct Ring *ring, size_t max) {
+    char discard[4096];
+    while(max) {
+        char *buf = discard;
+        size_t len = sizeof(discard);
+        if(ring->size) {
+            // read directly into the buffer, up to its end
+            size_t pos = ring->written % ring->size;
+            buf = ring->data + pos;
+            len = ring->size - pos;
+        }
+        if(len > max)
+            len = max;
+        ssize_t n = read(fd, buf, len);
+        if(n == 0)
+            return true;
+        if(n < 0) {
+            if(errno == EAGAIN || errno == EINTR)
+                return false;
+            die_perror("read");
+        }
+        if(ring->size)
+            ring->written += n;
+        max -= n;
+    }
+    return false;
+}
+
+// Read and throw away whatever available on non-blocking fd.
+static void discard(int fd) {
+    char buf[4096];
+    while(read(fd, buf, sizeof(buf)) > 0)
+        continue;
+}
+
+static void close_output(struct Task *task) {
+    loop_forget(task->outfd);
+    close(task->outfd);
+    task->outfd = -1;
+}
@@ -0,0 +1,51 @@
+/*
+ * output.h - capture output of tasks
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JAUTOLOCK_OUTPUT_H
+#define JAUTOLOCK_OUTPUT_H
+#include <stddef.h>
+struct Task;
+/**
+ * A fixed-size ring buffer keeping the last bytes written.
+ * data: the buffer, allocated on first use
+ * size: size of the buffer, zero if output is not captured
+ * written: number of bytes ever written
+ */
+struct Ring {
+    char *data;
+    size_t size;
+    unsigned long long written;
+};
+/**
+ * Prepare to capture the output of the task.
+ *
+ * Returns the write end of a pipe, which should become
+ * standard output and standard error of the task.
+ * Returns -1 if output of the task is not captured.
+ */
+int output_open(struct Task *task);
+/**
+ * Read whatever available on task->outfd without blocking,
+ * and close it on end of file.
+ */
+void output_drain(struct Task *task);
+/**
+ * Returns a free()-able copy of the captured output.
+ */
+char *output_get(const struct Task *task);
+#endif // JAUTOLOCK_OUTPUT_H
@@ -0,0 +1,216 @@
+/*
+ * power.c - conditions on the power source
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "power.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "die.h"
+#include "tasks.h"
+#include "timecalc.h"
+#include "trace.h"
+
+static bool read_on_ac(void);
+static bool read_attr(int dirfd, const char *supply, const char *attr,
+        char *buf, size_t size);
+static bool drain_uevents(void);
+static bool drain_inotify(void);
+static void apply(struct Task *tasks, unsigned n);
+
+static const char *const source_names[] = {
+    [POWER_ANY] = "any",
+    [POWER_AC] = "ac",
+    [POWER_BATTERY] = "battery",
+};
+
+static char *supply_dir;
+// kernel uevents (netlink), and changes of supply_dir (inotify);
+// sysfs attributes don't notify, but a fake tree for testing does
+static int uevent_fd = -1, inotify_fd = -1;
+// the cached state
+static bool on_ac = true;
+
+int power_parse(const char *name, enum PowerSource *source) {
+    for(unsigned i = 0; i < sizeof(source_names) / sizeof(source_names[0]);
+            i++)
+        if(strcmp(name, source_names[i]) == 0) {
+            *source = i;
+            return 0;
+        }
+    return -1;
+}
+
+void power_init(const char *dir, struct Task *tasks, unsigned n) {
+    bool wanted = false;
+    for(unsigned i = 0; i < n; i++)
+        wanted |= tasks[i].power != POWER_ANY;
+    if(!wanted)
+        return;
+    supply_dir = strdup(dir);
+    if(!supply_dir)
+        die_perror("strdup");
+
+    uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+            NETLINK_KOBJECT_UEVENT);
+    // group 1 is the kernel, group 2 udev
+    struct sockaddr_nl addr = {.nl_family = AF_NETLINK, .nl_groups = 1};
+    if(uevent_fd >= 0 &&
+            bind(uevent_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(uevent_fd);
+        uevent_fd = -1;
+    }
+    if(uevent_fd < 0)
+        fprintf(stderr, "WARNING: cannot receive uevents: %s\n",
+                strerror(errno));
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotify_fd < 0)
+        die_perror("inotify_init1");
+    if(inotify_add_watch(inotify_fd, supply_dir, IN_CREATE | IN_DELETE |
+                IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR) < 0)
+        fprintf(stderr, "WARNING: cannot watch %s: %s\n",
+                supply_dir, strerror(errno));
+
+    on_ac = read_on_ac();
+    trace(TRACE_POWER, on_ac);
+    apply(tasks, n);
+}
+
+unsigned power_fds(int *fds) {
+    unsigned n = 0;
+    if(uevent_fd >= 0)
+        fds[n++] = uevent_fd;
+    if(inotify_fd >= 0)
+        fds[n++] = inotify_fd;
+    return n;
+}
+
+bool power_update(struct Task *tasks, unsigned n) {
+    // drain both, or the other one stays readable
+    bool uevent = drain_uevents();
+    bool inotify = drain_inotify();
+    if(!uevent && !inotify)
+        return false;
+    // e.g. a battery reporting its charge
+    bool ac = read_on_ac();
+    if(ac == on_ac)
+        return false;
+    on_ac = ac;
+    trace(TRACE_POWER, on_ac);
+    apply(tasks, n);
+    return true;
+}
+
+/**
+ * Read the power supplies, and watch each of them for changes.
+ * Supplies of devices (e.g. a wireless mouse) don't count.
+ */
+static bool read_on_ac(void) {
+    DIR *dir = opendir(supply_dir);
+    if(!dir)
+        return true;
+    bool online = false, battery = false;
+    struct dirent *ent;
+    while((ent = readdir(dir))) {
+        if(ent->d_name[0] == '.')
+            continue;
+        // a supply already watched keeps its watch
+        char *path;
+        if(asprintf(&path, "%s/%s", supply_dir, ent->d_name) < 0)
+            die_perror("asprintf");
+        inotify_add_watch(inotify_fd, path,
+                IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR);
+        free(path);
+
+        char type[32], value[32];
+        if(!read_attr(dirfd(dir), ent->d_name, "type", type, sizeof(type)))
+            continue;
+        if(read_attr(dirfd(dir), ent->d_name, "scope", value, sizeof(value))
+                && strcmp(value, "Device") == 0)
+            continue;
+        if(strcmp(type, "Battery") == 0)
+            battery = true;
+        else if((strcmp(type, "Mains") == 0 || strcmp(type, "USB") == 0) &&
+                read_attr(dirfd(dir), ent->d_name, "online",
+                    value, sizeof(value)) && strcmp(value, "1") == 0)
+            online = true;
+    }
+    closedir(dir);
+    return online || !battery;
+}
+
+// Read the first line of supply/attr into buf, without the newline.
+static bool read_attr(int dirfd, const char *supply, const char *attr,
+        char *buf, size_t size) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", supply, attr);
+    int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return false;
+    ssize_t len = read(fd, buf, size - 1);
+    close(fd);
+    if(len < 0)
+        return false;
+    buf[len] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    return true;
+}
+
+// Whether any of the uevents received is about a power supply.
+static bool drain_uevents(void) {
+    if(uevent_fd < 0)
+        return false;
+    bool found = false;
+    char buf[8192];
+    ssize_t len;
+    while((len = recv(uevent_fd, buf, sizeof(buf) - 1, 0)) > 0) {
+        // "action@devpath", then "KEY=value" for each property,
+        // each terminated by NUL
+        buf[len] = '\0';
+        for(char *s = buf; s < buf + len; s += strlen(s) + 1)
+            if(strcmp(s, "SUBSYSTEM=power_supply") == 0)
+                found = true;
+    }
+    // some were dropped, possibly the ones we want
+    if(len < 0 && errno == ENOBUFS)
+        found = true;
+    return found;
+}
+
+// Whether there were any inotify events.
+static bool drain_inotify(void) {
+    bool found = false;
+    char buf[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    while(read(inotify_fd, buf, sizeof(buf)) > 0)
+        found = true;
+    return found;
+}
+
+static void apply(struct Task *tasks, unsigned n) {
+    for(unsigned i = 0; i < n; i++)
+        timecalc_set_disabled(tasks + i,
+                tasks[i].power == (on_ac ? POWER_BATTERY : POWER_AC));
+}
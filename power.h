@@ -0,0 +1,58 @@
+/*
+ * power.h - conditions on the power source
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JAUTOLOCK_POWER_H
+#define JAUTOLOCK_POWER_H
+#include <stdbool.h>
+struct Task;
+/**
+ * The power source a task is fired on.
+ */
+enum PowerSource {
+    POWER_ANY,
+    POWER_AC,
+    POWER_BATTERY,
+};
+/**
+ * Parse the name of a power source ("any", "ac" or "battery").
+ * Returns 0 on success and -1 on failure.
+ */
+int power_parse(const char *name, enum PowerSource *source);
+/**
+ * If any task depends on the power source, read it from the power
+ * supplies in dir (normally /sys/class/power_supply), start watching
+ * for changes, and set task->disabled of the tasks accordingly.
+ *
+ * The system is on AC if any "Mains" or "USB" supply is online,
+ * or if there is no battery at all.
+ */
+void power_init(const char *dir, struct Task *tasks, unsigned n);
+/**
+ * Store the descriptors to wait for in fds (at most 2).
+ * Returns how many there are.
+ */
+unsigned power_fds(int *fds);
+/**
+ * Called when any of the descriptors is readable: consume the events
+ * and read the power supplies again if they are about them.
+ *
+ * Returns true if the power source has changed,
+ * in which case task->disabled is set again.
+ */
+bool power_update(struct Task *tasks, unsigned n);
+#endif // JAUTOLOCK_POWER_H
@@ -0,0 +1,99 @@
+/*
+ * priority.c - how jautolock itself is scheduled
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "priority.h"
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+static const struct {
+    const char *name;
+    int policy;
+} policies[] = {
+    {"other", SCHED_OTHER},
+    {"batch", SCHED_BATCH},
+    {"idle", SCHED_IDLE},
+    {"fifo", SCHED_FIFO},
+    {"rr", SCHED_RR},
+};
+
+// what priority_apply could set, for priority_apply_thread()
+static int applied_policy = -1;
+static struct sched_param applied_param;
+static int applied_nice = INT_MIN;
+
+int priority_parse_policy(const char *name, int *policy) {
+    for(unsigned i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+        if(strcmp(name, policies[i].name) == 0) {
+            *policy = policies[i].policy;
+            return 0;
+        }
+    return -1;
+}
+
+const char *priority_policy_name(void) {
+    int policy = sched_getscheduler(0) & ~SCHED_RESET_ON_FORK;
+    for(unsigned i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+        if(policies[i].policy == policy)
+            return policies[i].name;
+    return "unknown";
+}
+
+void priority_apply(const struct Priority *priority) {
+    // only what is touched; all of Xlib would be read in otherwise
+    if(priority->lock_memory &&
+            mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) < 0)
+        fprintf(stderr, "WARNING: cannot lock memory: %s\n",
+                strerror(errno));
+
+    bool realtime = priority->policy == SCHED_FIFO ||
+        priority->policy == SCHED_RR;
+    if(priority->policy == SCHED_OTHER && priority->nice == INT_MIN)
+        return;
+    // only this thread; the others apply it themselves
+    struct sched_param param = {.sched_priority =
+        realtime ? priority->priority : 0};
+    if(sched_setscheduler(0, priority->policy | SCHED_RESET_ON_FORK,
+                &param) < 0) {
+        fprintf(stderr, "WARNING: cannot set scheduling policy: %s\n",
+                strerror(errno));
+    } else {
+        applied_policy = priority->policy;
+        applied_param = param;
+    }
+    if(!realtime && priority->nice != INT_MIN) {
+        if(setpriority(PRIO_PROCESS, 0, priority->nice) < 0)
+            fprintf(stderr, "WARNING: cannot set nice value %d: %s\n",
+                    priority->nice, strerror(errno));
+        else
+            applied_nice = priority->nice;
+    }
+}
+
+void priority_apply_thread(void) {
+    // as permitted for the main thread, so no warning again
+    if(applied_policy >= 0)
+        sched_setscheduler(0, applied_policy | SCHED_RESET_ON_FORK,
+                &applied_param);
+    if(applied_nice != INT_MIN)
+        setpriority(PRIO_PROCESS, 0, applied_nice);
+}
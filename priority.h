@@ -0,0 +1,61 @@
+/*
+ * priority.h - how jautolock itself is scheduled
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JAUTOLOCK_PRIORITY_H
+#define JAUTOLOCK_PRIORITY_H
+#include <stdbool.h>
+/**
+ * Settings to fire tasks in time on a loaded system.
+ * lock_memory: keep pages in memory once they are touched
+ * policy: SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO or SCHED_RR
+ * priority: static priority, for SCHED_FIFO and SCHED_RR
+ * nice: nice value, for the other policies (INT_MIN to leave it)
+ */
+struct Priority {
+    bool lock_memory;
+    int policy;
+    int priority;
+    int nice;
+};
+/**
+ * Parse the name of a policy ("other", "batch", "idle", "fifo" or "rr").
+ * Returns 0 on success and -1 on failure.
+ */
+int priority_parse_policy(const char *name, int *policy);
+/**
+ * Returns the name of the policy the calling thread has.
+ */
+const char *priority_policy_name(void);
+/**
+ * Apply the settings to the process, that is, the memory lock to all of
+ * it, and the policy and nice value to the calling thread.
+ * Threads started afterwards apply the policy and nice value
+ * to themselves with priority_apply_thread.
+ *
+ * Children don't get them: they start as SCHED_OTHER with a nice value
+ * of at least zero (SCHED_RESET_ON_FORK). So do new threads,
+ * until they call priority_apply_thread.
+ * Anything not permitted is reported by a warning.
+ */
+void priority_apply(const struct Priority *priority);
+/**
+ * Apply the policy and nice value set by priority_apply
+ * to the calling thread, as far as they were permitted.
+ */
+void priority_apply_thread(void);
+#endif // JAUTOLOCK_PRIORITY_H
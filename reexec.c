@@ -0,0 +1,206 @@
+/*
+ * reexec.c - restart jautolock in place, keeping its state
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "reexec.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "die.h"
+#include "tasks.h"
+#include "timecalc.h"
+
+static void set_task_cloexec(struct Task *tasks, unsigned n, bool cloexec);
+static void set_cloexec(int fd, bool cloexec);
+static bool read_timespec(FILE *f, struct timespec *t);
+
+// the state is passed as a memfd whose number is in this variable
+static const char *const state_env = "JAUTOLOCK_STATE_FD";
+// first line of the state, followed by the version of the format
+static const char *const state_magic = "jautolock-state";
+static const int state_version = 3;
+
+/*
+ * The state is text, so a binary built differently can read it:
+ *
+ *   jautolock-state 3
+ *   <connfd> <own_socket> <sigfd>
+ *   <last> <offset> <last_act> <busy_until> <busy> <was_busy>
+ *   <pid> <outfd> <logfd> <step> <disabled> <enabled_at> <name>
+ *   ...                                      (one line for each task)
+ *
+ * where each time is <seconds> <nanoseconds>, and <pid> is 0
+ * (and the descriptors -1) if the task is not running.
+ */
+void reexec(char **argv, int connfd, bool own_socket, int sigfd,
+        struct Task *tasks, unsigned n) {
+    // only inherited by the new image, not by tasks forked meanwhile
+    int memfd = memfd_create("jautolock-state", MFD_CLOEXEC);
+    if(memfd < 0) {
+        perror("memfd_create");
+        return;
+    }
+    FILE *f = fdopen(dup(memfd), "w");
+    if(!f) {
+        perror("fdopen");
+        close(memfd);
+        return;
+    }
+
+    struct TimecalcState state;
+    timecalc_get_state(&state);
+    fprintf(f, "%s %d\n%d %d %d\n", state_magic, state_version,
+            connfd, own_socket, sigfd);
+    fprintf(f, "%lld %ld %lld %ld %lld %ld %lld %ld %d %d\n",
+            (long long) state.last.tv_sec, state.last.tv_nsec,
+            (long long) state.offset.tv_sec, state.offset.tv_nsec,
+            (long long) state.last_act.tv_sec, state.last_act.tv_nsec,
+            (long long) state.busy_until.tv_sec, state.busy_until.tv_nsec,
+            state.busy, state.was_busy);
+    for(unsigned i = 0; i < n; i++) {
+        // the descriptors of a finished task are not passed
+        bool running = tasks[i].pid != 0;
+        fprintf(f, "%d %d %d %lld %ld %d %lld %ld %s\n", (int) tasks[i].pid,
+                running ? tasks[i].outfd : -1, running ? tasks[i].logfd : -1,
+                (long long) tasks[i].step.tv_sec, tasks[i].step.tv_nsec,
+                tasks[i].disabled, (long long) tasks[i].enabled_at.tv_sec,
+                tasks[i].enabled_at.tv_nsec, tasks[i].name);
+    }
+    if(fclose(f) != 0 || lseek(memfd, 0, SEEK_SET) < 0) {
+        perror("write state");
+        close(memfd);
+        return;
+    }
+
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", memfd);
+    setenv(state_env, buf, 1);
+    set_cloexec(memfd, false);
+    set_cloexec(connfd, false);
+    set_cloexec(sigfd, false);
+    set_task_cloexec(tasks, n, false);
+
+    execvp(argv[0], argv);
+    fprintf(stderr, "WARNING: cannot restart %s: %s\n",
+            argv[0], strerror(errno));
+
+    // so tasks don't inherit them
+    set_cloexec(connfd, true);
+    set_cloexec(sigfd, true);
+    set_task_cloexec(tasks, n, true);
+    unsetenv(state_env);
+    close(memfd);
+}
+
+bool reexec_restore(int *connfd, bool *own_socket, int *sigfd,
+        struct Task *tasks, unsigned n) {
+    const char *env = getenv(state_env);
+    if(!env)
+        return false;
+    int memfd = atoi(env);
+    unsetenv(state_env);
+    set_cloexec(memfd, true);
+    FILE *f = fdopen(memfd, "r");
+    if(!f)
+        die_perror("fdopen");
+
+    char magic[32];
+    int version;
+    struct TimecalcState state;
+    int own, busy, was_busy;
+    if(fscanf(f, "%31s %d", magic, &version) != 2 ||
+            strcmp(magic, state_magic) != 0 ||
+            version != state_version ||
+            fscanf(f, "%d %d %d", connfd, &own, sigfd) != 3 ||
+            !read_timespec(f, &state.last) ||
+            !read_timespec(f, &state.offset) ||
+            !read_timespec(f, &state.last_act) ||
+            !read_timespec(f, &state.busy_until) ||
+            fscanf(f, "%d %d", &busy, &was_busy) != 2)
+        die("Bad state passed from previous instance.\n");
+    *own_socket = own;
+    state.busy = busy;
+    state.was_busy = was_busy;
+    timecalc_set_state(&state);
+    set_cloexec(*connfd, true);
+    set_cloexec(*sigfd, true);
+
+    int pid, outfd, logfd, disabled;
+    struct timespec step, enabled_at;
+    char name[1024];
+    while(fscanf(f, "%d %d %d", &pid, &outfd, &logfd) == 3 &&
+            read_timespec(f, &step) &&
+            fscanf(f, "%d", &disabled) == 1 &&
+            read_timespec(f, &enabled_at) &&
+            fscanf(f, " %1023[^\n]", name) == 1) {
+        if(outfd >= 0)
+            set_cloexec(outfd, true);
+        if(logfd >= 0)
+            set_cloexec(logfd, true);
+        bool matched = false;
+        for(unsigned i = 0; i < n && !matched; i++)
+            if(strcmp(tasks[i].name, name) == 0) {
+                matched = true;
+                tasks[i].pid = pid;
+                tasks[i].outfd = outfd;
+                tasks[i].logfd = logfd;
+                tasks[i].step = step;
+                // power_init then enables or disables it from here
+                tasks[i].disabled = disabled;
+                tasks[i].enabled_at = enabled_at;
+            }
+        // the child is still reaped, just not tracked
+        if(!matched && outfd >= 0)
+            close(outfd);
+        if(!matched && logfd >= 0)
+            close(logfd);
+    }
+    fclose(f);
+    return true;
+}
+
+// The descriptors of running tasks, which are passed along.
+static void set_task_cloexec(struct Task *tasks, unsigned n, bool cloexec) {
+    for(unsigned i = 0; i < n; i++) {
+        if(!tasks[i].pid)
+            continue;
+        if(tasks[i].outfd >= 0)
+            set_cloexec(tasks[i].outfd, cloexec);
+        if(tasks[i].logfd >= 0)
+            set_cloexec(tasks[i].logfd, cloexec);
+    }
+}
+
+static void set_cloexec(int fd, bool cloexec) {
+    if(fcntl(fd, F_SETFD, cloexec ? FD_CLOEXEC : 0) < 0)
+        die_perror("fcntl");
+}
+
+static bool read_timespec(FILE *f, struct timespec *t) {
+    long long sec;
+    long nsec;
+    if(fscanf(f, "%lld %ld", &sec, &nsec) != 2)
+        return false;
+    t->tv_sec = sec;
+    t->tv_nsec = nsec;
+    return true;
+}
@@ -0,0 +1,47 @@
+/*
+ * reexec.h - restart jautolock in place, keeping its state
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JAUTOLOCK_REEXEC_H
+#define JAUTOLOCK_REEXEC_H
+#include <stdbool.h>
+struct Task;
+/**
+ * Execute argv[0] (searched in PATH) again with argv, passing along
+ * the listening socket connfd (and whether it is bound by jautolock
+ * itself), the signalfd sigfd, the running tasks (with the descriptors
+ * their output is read from and logged to), the timing of every task
+ * (including when it was last enabled, see power.h) and the state of
+ * timecalc.
+ *
+ * The control thread must be stopped, and the messages it read answered.
+ * Returns only if exec fails, with everything as it was.
+ */
+void reexec(char **argv, int connfd, bool own_socket, int sigfd,
+        struct Task *tasks, unsigned n);
+/**
+ * If this process is started by reexec, restore the state it passed.
+ * The listening socket and the signalfd are put in *connfd and *sigfd,
+ * and whether the socket is bound by jautolock itself in *own_socket.
+ * Tasks are matched by name.
+ *
+ * Call after timecalc_init, and before power_init.
+ * Returns false if this process is not started by reexec.
+ */
+bool reexec_restore(int *connfd, bool *own_socket, int *sigfd,
+        struct Task *tasks, unsigned n);
+#endif // JAUTOLOCK_REEXEC_H
@@ -17,11 +17,29 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "tasks.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
+#include "cgroup.h"
 #include "die.h"
+#include "output.h"
+#include "timespec.h"
+#include "trace.h"
+
+static pid_t spawn(struct Task *task, int syncfd);
+static void child_warn(const char *message);
+static void command_program(const char *command, char *file);
+static void find_program(const char *name, size_t len, char *file);
+static void readahead_file(const char *path);
 
 void execute_task(struct Task *task) {
     if(task->pid != 0) {
@@ -29,13 +47,146 @@ void execute_task(struct Task *task) {
         return;
     }
 
+    if(task->warm_pid) {
+        // release the waiting child, unless it died (e.g. was killed)
+        char go = 1;
+        if(write(task->warm_fd, &go, 1) == 1)
+            task->pid = task->warm_pid;
+        else if(errno != EPIPE)
+            die_perror("write");
+        close(task->warm_fd);
+        task->warm_pid = 0;
+        task->warm_fd = -1;
+    }
+    if(task->pid == 0)
+        task->pid = spawn(task, -1);
+    trace(TRACE_FIRE, task->pid);
+}
+
+void prewarm_task(struct Task *task, struct timespec step) {
+    if(task->pid != 0 || task->warm_pid != 0 ||
+            timespec_cmp(task->warm_step, step) == 0)
+        return;
+
+    int fds[2];
+    if(pipe2(fds, O_CLOEXEC) < 0)
+        die_perror("pipe2");
+    task->warm_pid = spawn(task, fds[0]);
+    close(fds[0]);
+    task->warm_fd = fds[1];
+    task->warm_step = step;
+    trace(TRACE_PREWARM, task->warm_pid);
+}
+
+void discard_prewarm(struct Task *task) {
+    if(task->warm_pid == 0)
+        return;
+    // the child exits on end of file, and is reaped as usual
+    close(task->warm_fd);
+    task->warm_pid = 0;
+    task->warm_fd = -1;
+}
+
+/**
+ * Fork a child to run the task.
+ *
+ * If syncfd is not -1, the child gets the program into page cache,
+ * then waits for a byte from syncfd before it runs the task.
+ * If end of file is read instead, it exits.
+ */
+static pid_t spawn(struct Task *task, int syncfd) {
+    int outfd = output_open(task);
+    cgroup_prepare(task);
+    // resolved before fork, as the child must not allocate
+    char shell[PATH_MAX] = "", program[PATH_MAX] = "";
+    if(syncfd >= 0) {
+        find_program("sh", 2, shell);
+        command_program(task->command, program);
+    }
+
     int pid = fork();
     if(pid == 0) {
+        // ignored by jautolock, which the task should not inherit
+        signal(SIGPIPE, SIG_DFL);
+        if(outfd >= 0 && (dup2(outfd, STDOUT_FILENO) < 0 ||
+                    dup2(outfd, STDERR_FILENO) < 0))
+            _exit(EXIT_FAILURE);
+        // before close_range, which would close the cgroup directory
+        cgroup_enter(task);
+        if(task->nice != INT_MIN && setpriority(PRIO_PROCESS, 0, task->nice) < 0)
+            child_warn("WARNING: cannot set the nice value of the task\n");
+        if(syncfd >= 0) {
+            // don't hold the write ends of pipes to other waiting children,
+            // or they won't see end of file (all but 0 to 2 are CLOEXEC)
+            if(dup2(syncfd, 3) < 0 || close_range(4, ~0u, 0) < 0)
+                _exit(EXIT_FAILURE);
+            readahead_file(shell);
+            readahead_file(program);
+            char go;
+            if(read(3, &go, 1) != 1)
+                _exit(EXIT_SUCCESS);
+            close(3);
+        }
         execlp("sh", "sh", "-c", task->command, NULL);
         _exit(EXIT_FAILURE);
     }
     if(pid < 0)
         die_perror("fork");
-    task->pid = pid;
+    if(outfd >= 0)
+        close(outfd);
+    return pid;
 }
 
+// Write to stderr without stdio, which is not safe after fork.
+static void child_warn(const char *message) {
+    if(write(STDERR_FILENO, message, strlen(message)) < 0)
+        return;
+}
+
+// Find the program the command starts with if it is a plain word,
+// see find_program.
+static void command_program(const char *command, char *file) {
+    file[0] = '\0';
+    command += strspn(command, " \t\n");
+    size_t len = strcspn(command, " \t\n;&|<>()$`'\"\\*?[]{}~=#");
+    if(len == 0 || (command[len] && !strchr(" \t\n", command[len])))
+        return;
+    find_program(command, len, file);
+}
+
+// Search PATH for the first len bytes of name like execlp() would,
+// and put the path into file (PATH_MAX bytes), or "" if not found.
+static void find_program(const char *name, size_t len, char *file) {
+    file[0] = '\0';
+    if(memchr(name, '/', len)) {
+        if(len < PATH_MAX)
+            snprintf(file, PATH_MAX, "%.*s", (int) len, name);
+        return;
+    }
+    const char *path = getenv("PATH");
+    if(!path)
+        path = "/bin:/usr/bin";
+    while(*path) {
+        size_t dirlen = strcspn(path, ":");
+        int n = snprintf(file, PATH_MAX, "%.*s/%.*s",
+                (int) dirlen, path, (int) len, name);
+        if(n > 0 && n < PATH_MAX && access(file, X_OK) == 0)
+            return;
+        path += dirlen;
+        path += *path == ':';
+    }
+    file[0] = '\0';
+}
+
+// Only system calls, as it runs in the forked child.
+static void readahead_file(const char *path) {
+    if(!*path)
+        return;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return;
+    struct stat st;
+    if(fstat(fd, &st) == 0)
+        readahead(fd, 0, st.st_size);
+    close(fd);
+}
@@ -18,20 +18,71 @@
  */
 #ifndef JAUTOLOCK_TASKS_H
 #define JAUTOLOCK_TASKS_H
+#include <stdbool.h>
 #include <time.h>
+#include "output.h"
+#include "power.h"
 /**
  * A tasks that may be fired by jautolock.
  * time: inactivity time before this program is fired
+ * every: if not zero, the task is fired again every this long after time
+ * until: if not zero, the task is not fired again after this time
+ * step: the deadline the task was last fired for
  * name: name of the task (used to fired it immediately)
  * command: command to run
  * pid: if zero, the task is not running
  *      otherwise, the task is running, and has this pid
+ * log: the last output of the task
+ * log_file: if not NULL, output of the task is also appended to it
+ * outfd: read end of the pipe the task writes to, -1 if none
+ * logfd: file descripter of log_file, -1 if not opened
+ * prewarm: if not zero, the task is forked this long before it is fired
+ * warm_pid: if not zero, a child forked in advance waiting to run the task
+ * warm_fd: pipe to release warm_pid through, -1 if none
+ * warm_step: the deadline a child was last prewarmed for, zero if none
+ *            since the task was last out of its lead time
+ * cgroup: whether the task runs in a cgroup of its own
+ * cpu_weight: if not zero, cpu.weight of that cgroup
+ * memory_max: if not NULL, memory.max of that cgroup
+ * cgroupfd: the cgroup directory, -1 if the task does not run in one
+ * cpu_base: CPU time used in the cgroup before the last run (microseconds)
+ * runs: number of runs in the cgroup finished so far
+ * cpu_usec: CPU time used by the last run, -1 if unknown
+ * mem_peak: peak memory usage of the last run in bytes, -1 if unknown
+ * power: the power source the task is fired on
+ * disabled: whether the task is not fired for now (see power.h)
+ * enabled_at: inactivity time the task was last enabled at, which it is
+ *             timed from instead of zero until new user activity
+ * nice: if not INT_MIN, the nice value the task runs with
  */
 struct Task {
     struct timespec time;
+    struct timespec every;
+    struct timespec until;
+    struct timespec step;
     const char *name;
     const char *command;
     pid_t pid;
+    struct Ring log;
+    const char *log_file;
+    int outfd;
+    int logfd;
+    struct timespec prewarm;
+    pid_t warm_pid;
+    int warm_fd;
+    struct timespec warm_step;
+    bool cgroup;
+    int cpu_weight;
+    const char *memory_max;
+    int cgroupfd;
+    long long cpu_base;
+    unsigned runs;
+    long long cpu_usec;
+    long long mem_peak;
+    enum PowerSource power;
+    bool disabled;
+    struct timespec enabled_at;
+    int nice;
 };
 /**
  * Forks and execute the specified task.
@@ -39,6 +90,24 @@ struct Task {
  * The task should not be running (i.e. task->pid should be 0).
  * If this condition is not hold, the task will not be run
  * and a warning will be printed.
+ *
+ * If the task is prewarmed, the waiting child is released instead,
+ * or if it has died, the task is forked as usual.
  */
 void execute_task(struct Task *task);
+/**
+ * Forks a child that loads the program of the task
+ * and waits for execute_task to release it at the deadline step.
+ *
+ * Does nothing if the task is running, or was already prewarmed for
+ * step, even if that child has died since (so a child killed over and
+ * over is not forked again and again; the task is forked at step then).
+ */
+void prewarm_task(struct Task *task, struct timespec step);
+/**
+ * Tells the waiting child of a prewarmed task to exit.
+ *
+ * Does nothing if the task is not prewarmed.
+ */
+void discard_prewarm(struct Task *task);
 #endif // JAUTOLOCK_TASKS_H
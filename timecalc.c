@@ -17,21 +17,27 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "timecalc.h"
-#include <X11/Xlib.h>
-#include <X11/extensions/scrnsaver.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/time.h>
 #include <time.h>
-#include "tasks.h"
 #include "die.h"
+#include "idle.h"
+#include "inhibit.h"
+#include "tasks.h"
+#include "timespec.h"
+#include "trace.h"
+#include "watchdog.h"
 
-static struct timespec get_idle_time(void);
-static int timespec_cmp(struct timespec lhs, struct timespec rhs);
-static struct timespec timespec_add(struct timespec lhs, struct timespec rhs);
-static struct timespec timespec_sub(struct timespec lhs, struct timespec rhs);
-static void timespec_minify(struct timespec *lhs, struct timespec rhs);
-static void timespec_maxify(struct timespec *lhs, struct timespec rhs);
+static bool is_busy_at(struct timespec cur, struct timespec *next_edge);
+static bool next_step(const struct Task *task, struct timespec after,
+        struct timespec *step);
+static struct timespec last_step(const struct Task *task, struct timespec upto);
+static bool any_due(const struct Task *tasks, unsigned n, struct timespec end);
+static bool next_poll(const struct Task *tasks, unsigned n,
+        struct timespec running, struct timespec *poll);
+static struct timespec backed_off(struct timespec interval);
 
 static const struct timespec very_long_time = {31536000, 0}; // 1 year
 static const struct timespec activity_error = {0, 10000000}; // 10ms
@@ -42,6 +48,21 @@ static struct timespec last, offset;
 static struct timespec last_act;
 // if busy, assume user is always active
 static bool busy;
+// if non-zero, also assume user is active until this time
+static struct timespec busy_until;
+// whether user was assumed to be busy in last cycle
+static bool was_busy;
+// whether the last cycle asked to be woken up right away
+static bool woke_now;
+static const struct Inhibit *inhibits;
+static unsigned n_inhibit;
+// when the idle time was last queried
+static struct timespec last_sample;
+// while a task is running, poll for activity 2^poll_shift times
+// less often, up to poll_max (disabled if zero)
+static unsigned poll_shift;
+static struct timespec poll_max = {60, 0};
+static unsigned long long samples, samples_avoided;
 
 void timecalc_init(void) {
     last = (const struct timespec) {0, 0};
@@ -49,10 +70,16 @@ void timecalc_init(void) {
         die_perror("clock_gettime");
     last_act = offset;
     busy = false;
+    busy_until = (const struct timespec) {0, 0};
+    was_busy = false;
+    last_sample = offset;
+    woke_now = false;
+    poll_shift = 0;
 }
 
 void timecalc_cycle(struct timespec *timeout,
         struct Task *tasks, unsigned n) {
+    trace(TRACE_CYCLE_START, 0);
     struct timespec cur;
     if(clock_gettime(CLOCK_MONOTONIC, &cur) < 0)
         die_perror("clock_gettime");
@@ -60,124 +87,303 @@ void timecalc_cycle(struct timespec *timeout,
     struct timespec running = {0, 0};
     for(unsigned i = 0; i < n; i++)
         if(tasks[i].pid)
-            timespec_maxify(&running, tasks[i].time);
+            timespec_maxify(&running, tasks[i].step);
 
-    struct timespec idle = get_idle_time();
-    if(busy)
-        idle = (const struct timespec) {0, 0};
+    struct timespec busy_edge = very_long_time;
+    bool now_busy = is_busy_at(cur, &busy_edge);
+
+    // leaving busy state also counts as activity,
+    // so the tasks are timed from the end of it
+    struct timespec idle = {0, 0};
+    bool sampled = false;
+    if(!now_busy && !was_busy) {
+        // user activity can only postpone tasks, so the last sample is
+        // as good as a new one unless a task would be fired,
+        // or it is time to poll for activity
+        struct timespec poll;
+        bool poll_due = next_poll(tasks, n, running, &poll) &&
+            timespec_cmp(poll, cur) <= 0;
+        if(!poll_due && !any_due(tasks, n, timespec_sub(cur, offset))) {
+            idle = timespec_sub(cur, last_act);
+            samples_avoided++;
+        } else {
+            enum WatchPhase phase = watch_phase(WATCH_IDLE);
+            idle = get_idle_time();
+            watch_phase(phase);
+            sampled = true;
+            last_sample = cur;
+            samples++;
+            trace(TRACE_IDLE, timespec_ms(idle));
+        }
+    }
+    was_busy = now_busy;
 
     struct timespec activity = timespec_sub(cur, idle);
 
+    bool active = false;
     if(timespec_cmp(last, running) < 0) {
         // assume new user activity now
+        active = true;
         last = running;
         offset = timespec_sub(cur, running);
         activity = cur;
     } else if(timespec_cmp(timespec_sub(activity, last_act), activity_error) > 0) {
         // detected new user activity
+        trace(TRACE_ACTIVITY, 0);
+        active = true;
         last = running;
         offset = timespec_sub(activity, running);
     }
 
     last_act = activity;
+    // tasks enabled in the meantime are timed from the activity again
+    if(active)
+        for(unsigned i = 0; i < n; i++)
+            tasks[i].enabled_at = (const struct timespec) {0, 0};
+
+    if(active || (!running.tv_sec && !running.tv_nsec))
+        poll_shift = 0;
+    else if(sampled && poll_shift < 32)
+        poll_shift++;
 
+    // a repeating task is fired once even if several of its steps passed
+    enum WatchPhase phase = watch_phase(WATCH_FIRE);
     struct timespec end = timespec_sub(cur, offset);
-    for(unsigned i = 0; i < n; i++)
-        if(timespec_cmp(last, tasks[i].time) < 0 &&
-                timespec_cmp(tasks[i].time, end) <= 0) {
+    for(unsigned i = 0; i < n; i++) {
+        struct timespec step;
+        if(!tasks[i].pid && next_step(tasks + i, last, &step) &&
+                timespec_cmp(step, end) <= 0) {
             execute_task(tasks + i);
-            timespec_maxify(&running, tasks[i].time);
+            tasks[i].step = last_step(tasks + i, end);
+            timespec_maxify(&running, tasks[i].step);
         }
+    }
     last = end;
 
+    // prewarm tasks within their lead time, and discard the ones
+    // that are no longer (new user activity)
+    for(unsigned i = 0; i < n; i++) {
+        if(!tasks[i].prewarm.tv_sec && !tasks[i].prewarm.tv_nsec)
+            continue;
+        struct timespec step;
+        if(next_step(tasks + i, last, &step) && timespec_cmp(
+                    timespec_sub(step, tasks[i].prewarm), last) <= 0) {
+            prewarm_task(tasks + i, step);
+        } else {
+            discard_prewarm(tasks + i);
+            tasks[i].warm_step = (const struct timespec) {0, 0};
+        }
+    }
+    watch_phase(phase);
+
     *timeout = very_long_time;
-    if(!busy) {
+    if(!now_busy) {
         for(unsigned i = 0; i < n; i++) {
-            if(timespec_cmp(tasks[i].time, last) > 0)
-                timespec_minify(timeout, timespec_sub(tasks[i].time, last));
-            if(timespec_cmp(tasks[i].time, running) > 0)
-                timespec_minify(timeout, timespec_sub(tasks[i].time, running));
+            struct timespec step;
+            if(next_step(tasks + i, last, &step)) {
+                timespec_minify(timeout, timespec_sub(step, last));
+                struct timespec warm = timespec_sub(step, tasks[i].prewarm);
+                if(timespec_cmp(warm, last) > 0)
+                    timespec_minify(timeout, timespec_sub(warm, last));
+            }
+        }
+        struct timespec poll;
+        if(next_poll(tasks, n, running, &poll)) {
+            timespec_maxify(&poll, cur);
+            timespec_minify(timeout, timespec_sub(poll, cur));
         }
-        timespec_maxify(timeout, min_sleep_time);
+        // something due now is handled right away, but only once,
+        // so nothing can make the loop spin
+        bool now = !timeout->tv_sec && !timeout->tv_nsec;
+        if(now && woke_now)
+            *timeout = min_sleep_time;
+        woke_now = now;
+    } else {
+        // wake up exactly when busy state may end
+        timespec_minify(timeout, busy_edge);
     }
+    trace(TRACE_CYCLE_END, timespec_ms(*timeout));
+}
+
+void timecalc_fire(struct Task *task) {
+    execute_task(task);
+    // as if fired on schedule, so the tasks after it follow from now on
+    struct timespec step;
+    if(!next_step(task, last, &step))
+        step = last;
+    task->step = step;
 }
 
 void timecalc_set_busy(bool b) {
     busy = b;
+    busy_until = (const struct timespec) {0, 0};
+}
+void timecalc_set_busy_for(struct timespec duration) {
+    struct timespec cur;
+    if(clock_gettime(CLOCK_MONOTONIC, &cur) < 0)
+        die_perror("clock_gettime");
+    busy = false;
+    busy_until = timespec_add(cur, duration);
 }
 bool timecalc_is_busy(void) {
-    return busy;
+    struct timespec cur, edge = very_long_time;
+    if(clock_gettime(CLOCK_MONOTONIC, &cur) < 0)
+        die_perror("clock_gettime");
+    return is_busy_at(cur, &edge);
+}
+void timecalc_set_inhibits(const struct Inhibit *list, unsigned n) {
+    inhibits = list;
+    n_inhibit = n;
+}
+void timecalc_set_disabled(struct Task *task, bool disabled) {
+    if(task->disabled && !disabled) {
+        struct timespec cur;
+        if(clock_gettime(CLOCK_MONOTONIC, &cur) < 0)
+            die_perror("clock_gettime");
+        task->enabled_at = timespec_sub(cur, offset);
+    }
+    task->disabled = disabled;
+}
+void timecalc_set_poll_max(struct timespec max) {
+    poll_max = max;
+}
+void timecalc_get_samples(unsigned long long *made,
+        unsigned long long *avoided) {
+    *made = samples;
+    *avoided = samples_avoided;
+}
+void timecalc_get_state(struct TimecalcState *state) {
+    *state = (struct TimecalcState) {
+        last, offset, last_act, busy_until, busy, was_busy
+    };
+}
+void timecalc_set_state(const struct TimecalcState *state) {
+    last = state->last;
+    offset = state->offset;
+    last_act = state->last_act;
+    busy_until = state->busy_until;
+    busy = state->busy;
+    was_busy = state->was_busy;
 }
 
 /**
- * Get user idle time using the xscreensaver extension.
+ * Whether user is assumed to be busy at monotonic time cur.
+ *
+ * If this may change without further messages, the time from cur
+ * until then is minified into *next_edge.
  */
-static struct timespec get_idle_time(void) {
-    Display *display = XOpenDisplay(NULL);
-    if(!display)
-        die("Cannot open display.\n");
-    XScreenSaverInfo *info = XScreenSaverAllocInfo();
-    if(!info) {
-        XCloseDisplay(display);
-        die("Cannot allocate XScreenSaverInfo.\n");
+static bool is_busy_at(struct timespec cur, struct timespec *next_edge) {
+    if(busy)
+        return true;
+
+    bool result = false;
+    if(timespec_cmp(busy_until, cur) > 0) {
+        result = true;
+        timespec_minify(next_edge, timespec_sub(busy_until, cur));
     }
-    if(!XScreenSaverQueryInfo(display, XDefaultRootWindow(display), info)) {
-        XFree(info);
-        XCloseDisplay(display);
-        die("X screen saver extension not supported.\n");
+
+    if(n_inhibit) {
+        struct timespec real;
+        if(clock_gettime(CLOCK_REALTIME, &real) < 0)
+            die_perror("clock_gettime");
+        time_t edge;
+        if(inhibit_active(inhibits, n_inhibit, real.tv_sec, &edge))
+            result = true;
+        struct timespec edge_ts = {edge, 0};
+        timespec_minify(next_edge, timespec_sub(edge_ts, real));
     }
+    return result;
+}
 
-    struct timespec idle;
-    idle.tv_sec  = info->idle / 1000,
-    idle.tv_nsec = info->idle % 1000 * 1000000;
-
-    XFree(info);
-    XCloseDisplay(display);
-    return idle;
-}
-
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-function"
-// lhs > rhs ? 1 : lhs < rhs ? -1 : 0
-static int timespec_cmp(struct timespec lhs, struct timespec rhs) {
-    if(lhs.tv_sec < rhs.tv_sec)
-        return -1;
-    if(lhs.tv_sec > rhs.tv_sec)
-        return 1;
-    if(lhs.tv_nsec < rhs.tv_nsec)
-        return -1;
-    if(lhs.tv_nsec > rhs.tv_nsec)
-        return 1;
-    return 0;
-}
-// lhs + rhs
-static struct timespec timespec_add(struct timespec lhs, struct timespec rhs) {
-    lhs.tv_sec += rhs.tv_sec;
-    lhs.tv_nsec += rhs.tv_nsec;
-    if(lhs.tv_nsec >= 1000000000) {
-        lhs.tv_nsec -= 1000000000;
-        lhs.tv_sec += 1;
+/**
+ * Find the first deadline of the task after time after.
+ * Returns false if there is none (or the task is disabled).
+ *
+ * Deadlines count from task->enabled_at.
+ */
+static bool next_step(const struct Task *task, struct timespec after,
+        struct timespec *step) {
+    if(task->disabled)
+        return false;
+    timespec_maxify(&after, task->enabled_at);
+    after = timespec_sub(after, task->enabled_at);
+    if(timespec_cmp(task->time, after) > 0) {
+        *step = timespec_add(task->time, task->enabled_at);
+        return true;
     }
-    return lhs;
-}
-// lhs - rhs
-static struct timespec timespec_sub(struct timespec lhs, struct timespec rhs) {
-    lhs.tv_sec -= rhs.tv_sec;
-    if(lhs.tv_nsec < rhs.tv_nsec) {
-        lhs.tv_nsec += 1000000000;
-        lhs.tv_sec -= 1;
+    if(!task->every.tv_sec && !task->every.tv_nsec)
+        return false;
+    int64_t every = timespec_ns(task->every);
+    int64_t k = (timespec_ns(after) - timespec_ns(task->time)) / every + 1;
+    *step = ns_timespec(timespec_ns(task->time) + k * every);
+    bool within = (!task->until.tv_sec && !task->until.tv_nsec) ||
+        timespec_cmp(*step, task->until) <= 0;
+    *step = timespec_add(*step, task->enabled_at);
+    return within;
+}
+/**
+ * Find the last deadline of the task not after time upto.
+ * The first deadline (task->time) must not be after upto.
+ */
+static struct timespec last_step(const struct Task *task, struct timespec upto) {
+    if(!task->every.tv_sec && !task->every.tv_nsec)
+        return timespec_add(task->time, task->enabled_at);
+    upto = timespec_sub(upto, task->enabled_at);
+    if((task->until.tv_sec || task->until.tv_nsec) &&
+            timespec_cmp(upto, task->until) > 0)
+        upto = task->until;
+    int64_t every = timespec_ns(task->every);
+    int64_t k = (timespec_ns(upto) - timespec_ns(task->time)) / every;
+    return ns_timespec(timespec_ns(task->time) + k * every +
+            timespec_ns(task->enabled_at));
+}
+
+/**
+ * Whether any task not running has a deadline not after end.
+ */
+static bool any_due(const struct Task *tasks, unsigned n, struct timespec end) {
+    for(unsigned i = 0; i < n; i++) {
+        struct timespec step;
+        if(!tasks[i].pid && next_step(tasks + i, last, &step) &&
+                timespec_cmp(step, end) <= 0)
+            return true;
     }
-    lhs.tv_nsec -= rhs.tv_nsec;
-    return lhs;
+    return false;
 }
-// *lhs = min(*lhs, rhs)
-static void timespec_minify(struct timespec *lhs, struct timespec rhs) {
-    if(timespec_cmp(*lhs, rhs) > 0)
-        *lhs = rhs;
+
+/**
+ * When to query the idle time next, so that the first task after
+ * the running ones (or the first task, if none is running) is fired
+ * in time after activity. It is timed from the last query.
+ * Returns false if there is no such task.
+ */
+static bool next_poll(const struct Task *tasks, unsigned n,
+        struct timespec running, struct timespec *poll) {
+    struct timespec interval = very_long_time;
+    bool found = false;
+    for(unsigned i = 0; i < n; i++) {
+        struct timespec step;
+        if(next_step(tasks + i, running, &step)) {
+            timespec_minify(&interval, timespec_sub(step, running));
+            found = true;
+        }
+    }
+    *poll = timespec_add(last_sample, backed_off(interval));
+    return found;
 }
-// *lhs = max(*lhs, rhs)
-static void timespec_maxify(struct timespec *lhs, struct timespec rhs) {
-    if(timespec_cmp(*lhs, rhs) < 0)
-        *lhs = rhs;
+
+/**
+ * The interval to poll for activity while a task is running.
+ * Each sample without activity doubles it, but not beyond poll_max
+ * (nor does poll_max shorten it).
+ */
+static struct timespec backed_off(struct timespec interval) {
+    if(!poll_max.tv_sec && !poll_max.tv_nsec)
+        return interval;
+    int64_t ns = timespec_ns(interval), max = timespec_ns(poll_max);
+    if(ns >= max)
+        return interval;
+    if(poll_shift >= 32 || ns > max >> poll_shift)
+        return poll_max;
+    return ns_timespec(ns << poll_shift);
 }
-#pragma GCC diagnostic pop
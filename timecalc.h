@@ -18,11 +18,23 @@
  */
 #ifndef JAUTOLOCK_TIMECALC_H
 #define JAUTOLOCK_TIMECALC_H
+#include <time.h>
 /**
- * Forward declarations. See "tasks.h" and <time.h> respectively.
+ * Forward declarations. See "tasks.h" and "inhibit.h" respectively.
  */
 struct Task;
-struct timespec;
+struct Inhibit;
+/**
+ * Everything timecalc remembers between cycles (see timecalc.c).
+ */
+struct TimecalcState {
+    struct timespec last;
+    struct timespec offset;
+    struct timespec last_act;
+    struct timespec busy_until;
+    _Bool busy;
+    _Bool was_busy;
+};
 /**
  * Call this before calling any other methods here.
  */
@@ -32,16 +44,55 @@ void timecalc_init(void);
  * appropriate time to sleep so the next task
  * will be run on time.
  *
- * The maximum sleep time is 365 days,
- * and the mimimum is 10 milliseconds.
- * TODO add configuration for this
- * TODO somehow returns "infinity" sleep time
+ * The sleep time is at most 365 days, which stands for "until
+ * something else happens". It is zero if something is due right away,
+ * but never twice in a row: then it is 10 milliseconds, so the caller
+ * can't spin.
  */
 void timecalc_cycle(struct timespec *sleep_time,
         struct Task *tasks, unsigned n);
+/**
+ * Fire task now, by hand. Until new user activity, the tasks are
+ * timed as if its next deadline had been reached.
+ */
+void timecalc_fire(struct Task *task);
 /**
  * If busy, assume user is always active.
  */
 void timecalc_set_busy(_Bool busy);
+/**
+ * Assume user is always active for the specified duration.
+ * Overrides timecalc_set_busy(true) (and vice versa).
+ */
+void timecalc_set_busy_for(struct timespec duration);
+/**
+ * Whether user is assumed to be active, for whatever reason.
+ */
 _Bool timecalc_is_busy(void);
+/**
+ * Also assume user is always active during these windows.
+ * The list is not copied and must outlive further calls.
+ */
+void timecalc_set_inhibits(const struct Inhibit *inhibits, unsigned n);
+/**
+ * Set task->disabled. A task enabled by this is timed from now,
+ * like after user activity; other tasks keep their timing.
+ */
+void timecalc_set_disabled(struct Task *task, _Bool disabled);
+/**
+ * While a task is running, the idle time is polled less and less
+ * often, but at least once per max. Zero disables this.
+ */
+void timecalc_set_poll_max(struct timespec max);
+/**
+ * How many times the idle time has been queried,
+ * and how many queries were avoided as unnecessary.
+ */
+void timecalc_get_samples(unsigned long long *made,
+        unsigned long long *avoided);
+/**
+ * Save and restore the state, so it can be carried over by reexec.
+ */
+void timecalc_get_state(struct TimecalcState *state);
+void timecalc_set_state(const struct TimecalcState *state);
 #endif // JAUTOLOCK_TIMECALC_H
@@ -0,0 +1,89 @@
+/*
+ * timespec.h - arithmetic on struct timespec
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JAUTOLOCK_TIMESPEC_H
+#define JAUTOLOCK_TIMESPEC_H
+#include <stdint.h>
+#include <time.h>
+// lhs > rhs ? 1 : lhs < rhs ? -1 : 0
+static inline int timespec_cmp(struct timespec lhs, struct timespec rhs) {
+    if(lhs.tv_sec < rhs.tv_sec)
+        return -1;
+    if(lhs.tv_sec > rhs.tv_sec)
+        return 1;
+    if(lhs.tv_nsec < rhs.tv_nsec)
+        return -1;
+    if(lhs.tv_nsec > rhs.tv_nsec)
+        return 1;
+    return 0;
+}
+// lhs + rhs
+static inline struct timespec timespec_add(struct timespec lhs,
+        struct timespec rhs) {
+    lhs.tv_sec += rhs.tv_sec;
+    lhs.tv_nsec += rhs.tv_nsec;
+    if(lhs.tv_nsec >= 1000000000) {
+        lhs.tv_nsec -= 1000000000;
+        lhs.tv_sec += 1;
+    }
+    return lhs;
+}
+// lhs - rhs
+static inline struct timespec timespec_sub(struct timespec lhs,
+        struct timespec rhs) {
+    lhs.tv_sec -= rhs.tv_sec;
+    if(lhs.tv_nsec < rhs.tv_nsec) {
+        lhs.tv_nsec += 1000000000;
+        lhs.tv_sec -= 1;
+    }
+    lhs.tv_nsec -= rhs.tv_nsec;
+    return lhs;
+}
+// t in milliseconds, saturated to UINT32_MAX
+static inline uint32_t timespec_ms(struct timespec t) {
+    if(t.tv_sec >= UINT32_MAX / 1000)
+        return UINT32_MAX;
+    return t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+// t in nanoseconds
+static inline int64_t timespec_ns(struct timespec t) {
+    return (int64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+// inverse of timespec_ns, for non-negative ns
+static inline struct timespec ns_timespec(int64_t ns) {
+    return (struct timespec) {ns / 1000000000, ns % 1000000000};
+}
+// *lhs = min(*lhs, rhs)
+static inline void timespec_minify(struct timespec *lhs,
+        struct timespec rhs) {
+    if(timespec_cmp(*lhs, rhs) > 0)
+        *lhs = rhs;
+}
+// *lhs = max(*lhs, rhs)
+static inline void timespec_maxify(struct timespec *lhs,
+        struct timespec rhs) {
+    if(timespec_cmp(*lhs, rhs) < 0)
+        *lhs = rhs;
+}
+// CLOCK_MONOTONIC in nanoseconds
+static inline uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+#endif // JAUTOLOCK_TIMESPEC_H
@@ -0,0 +1,109 @@
+/*
+ * trace.c - in-memory ring of events for post-mortem debugging
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "trace.h"
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_SIZE 4096 // must be a power of 2
+
+static const char *const type_names[] = {
+    [TRACE_CYCLE_START] = "cycle-start",
+    [TRACE_CYCLE_END] = "cycle-end",
+    [TRACE_IDLE] = "idle",
+    [TRACE_ACTIVITY] = "activity",
+    [TRACE_FIRE] = "fire",
+    [TRACE_REAP] = "reap",
+    [TRACE_MESSAGE] = "message",
+    [TRACE_PREWARM] = "prewarm",
+    [TRACE_STALL] = "stall",
+    [TRACE_POWER] = "power",
+};
+
+static struct TraceEvent events[TRACE_SIZE];
+// number of events ever recorded
+static atomic_uint_fast64_t n_event;
+
+void trace(enum TraceType type, uint32_t arg) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    uint64_t i = atomic_fetch_add_explicit(&n_event, 1, memory_order_relaxed);
+    events[i & (TRACE_SIZE - 1)] = (struct TraceEvent) {
+        (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec, type, arg
+    };
+}
+
+char *trace_dump(unsigned count) {
+    uint64_t n = atomic_load_explicit(&n_event, memory_order_relaxed);
+    if(count > n)
+        count = n;
+    if(count > TRACE_SIZE)
+        count = TRACE_SIZE;
+
+    char *s;
+    size_t len;
+    FILE *f = open_memstream(&s, &len);
+    if(!f)
+        return NULL;
+    for(uint64_t i = n - count; i < n; i++) {
+        const struct TraceEvent *e = events + (i & (TRACE_SIZE - 1));
+        fprintf(f, "%llu.%09llu %s %lu\n",
+                (unsigned long long) (e->time / 1000000000),
+                (unsigned long long) (e->time % 1000000000),
+                e->type < sizeof(type_names) / sizeof(type_names[0]) ?
+                    type_names[e->type] : "?",
+                (unsigned long) e->arg);
+    }
+    if(fclose(f))
+        return NULL;
+    return s;
+}
+
+void trace_flush(void) {
+    uint64_t n = atomic_load_explicit(&n_event, memory_order_relaxed);
+    if(n == 0)
+        return;
+
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if(!dir)
+        dir = "/tmp";
+    char path[4096];
+    if(snprintf(path, sizeof(path), "%s/jautolock.trace", dir)
+            >= (int) sizeof(path))
+        return;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd < 0)
+        return;
+    // this is called on the way out, so errors are ignored
+    bool ok = true;
+    if(n > TRACE_SIZE) {
+        size_t start = n & (TRACE_SIZE - 1);
+        ok = write(fd, events + start,
+                (TRACE_SIZE - start) * sizeof(struct TraceEvent)) >= 0;
+        n = start;
+    }
+    if(ok && write(fd, events, n * sizeof(struct TraceEvent)) >= 0)
+        fprintf(stderr, "Trace written to %s\n", path);
+    close(fd);
+}
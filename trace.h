@@ -0,0 +1,61 @@
+/*
+ * trace.h - in-memory ring of events for post-mortem debugging
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JAUTOLOCK_TRACE_H
+#define JAUTOLOCK_TRACE_H
+#include <stdint.h>
+/**
+ * Kinds of events, and what their argument means.
+ */
+enum TraceType {
+    TRACE_CYCLE_START,  // none
+    TRACE_CYCLE_END,    // timeout in milliseconds
+    TRACE_IDLE,         // idle time sampled in milliseconds
+    TRACE_ACTIVITY,     // none
+    TRACE_FIRE,         // pid of the task
+    TRACE_REAP,         // pid of the task
+    TRACE_MESSAGE,      // length of the message
+    TRACE_PREWARM,      // pid of the waiting child
+    TRACE_STALL,        // phase the main loop is stuck in (see watchdog.h)
+    TRACE_POWER,        // 1 if on AC, 0 if on battery
+};
+/**
+ * An event as kept in memory and written to the trace file.
+ * time: CLOCK_MONOTONIC in nanoseconds
+ */
+struct TraceEvent {
+    uint64_t time;
+    uint32_t type;
+    uint32_t arg;
+};
+/**
+ * Record an event.
+ */
+void trace(enum TraceType type, uint32_t arg);
+/**
+ * Returns a free()-able human readable list of the last count events.
+ */
+char *trace_dump(unsigned count);
+/**
+ * Write the recorded events, oldest first, as struct TraceEvent
+ * in native byte order to $XDG_RUNTIME_DIR/jautolock.trace.
+ *
+ * Does nothing if no event is recorded.
+ */
+void trace_flush(void);
+#endif // JAUTOLOCK_TRACE_H
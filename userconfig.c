@@ -19,32 +19,97 @@
 #include "userconfig.h"
 #include <basedir_fs.h>
 #include <confuse.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include "die.h"
+#include "inhibit.h"
+#include "power.h"
+#include "priority.h"
 #include "tasks.h"
+#include "timespec.h"
 
+static const char *arena_strcpy(char **arena, const char *s);
 static char *get_config_path(const char *const_config_path);
-static int parse_time(const char *s, struct timespec *t);
 static int config_validate_time(cfg_t *cfg, cfg_opt_t *opt);
+static int config_validate_duration(cfg_t *cfg, cfg_opt_t *opt);
 static int config_validate_task(cfg_t *cfg, cfg_opt_t *opt);
+static int config_validate_log_size(cfg_t *cfg, cfg_opt_t *opt);
+static int config_validate_cpu_weight(cfg_t *cfg, cfg_opt_t *opt);
+static int config_validate_memory_max(cfg_t *cfg, cfg_opt_t *opt);
+static int config_validate_power(cfg_t *cfg, cfg_opt_t *opt);
+static int config_validate_nice(cfg_t *cfg, cfg_opt_t *opt);
+static int config_validate_sched_policy(cfg_t *cfg, cfg_opt_t *opt);
+static int config_validate_sched_priority(cfg_t *cfg, cfg_opt_t *opt);
+static int config_validate_days(cfg_t *cfg, cfg_opt_t *opt);
+static int config_validate_clock(cfg_t *cfg, cfg_opt_t *opt);
 
 static cfg_opt_t task_opts[] = {
     CFG_STR("time", "600s", CFGF_NONE),
     CFG_STR("command", NULL, CFGF_NODEFAULT),
+    CFG_INT("log_size", 0, CFGF_NONE),
+    CFG_STR("log_file", NULL, CFGF_NONE),
+    CFG_STR("prewarm", NULL, CFGF_NONE),
+    CFG_STR("every", NULL, CFGF_NONE),
+    CFG_STR("until", NULL, CFGF_NONE),
+    CFG_BOOL("cgroup", cfg_false, CFGF_NONE),
+    CFG_INT("cpu_weight", 0, CFGF_NONE),
+    CFG_STR("memory_max", NULL, CFGF_NONE),
+    CFG_STR("power", "any", CFGF_NONE),
+    // INT_MIN: not set, so that 0 can be asked for
+    CFG_INT("nice", INT_MIN, CFGF_NONE),
+    CFG_END()
+};
+static cfg_opt_t inhibit_opts[] = {
+    CFG_STR("days", "sun-sat", CFGF_NONE),
+    CFG_STR("from", "00:00", CFGF_NONE),
+    CFG_STR("until", "24:00", CFGF_NONE),
     CFG_END()
 };
 static cfg_opt_t opts[] = {
     CFG_SEC("task", task_opts, CFGF_MULTI | CFGF_TITLE),
+    CFG_SEC("inhibit", inhibit_opts, CFGF_MULTI | CFGF_TITLE),
+    CFG_STR("poll_max", "1m", CFGF_NONE),
+    CFG_STR("cycle_budget", "1s", CFGF_NONE),
+    CFG_STR("power_supply_dir", "/sys/class/power_supply", CFGF_NONE),
+    CFG_BOOL("lock_memory", cfg_false, CFGF_NONE),
+    CFG_STR("sched_policy", "other", CFGF_NONE),
+    CFG_INT("sched_priority", 1, CFGF_NONE),
+    CFG_INT("nice", INT_MIN, CFGF_NONE),
     CFG_END()
 };
 
+static const char *const weekdays[] = {
+    "sun", "mon", "tue", "wed", "thu", "fri", "sat"
+};
+
 cfg_t *read_config(const char *const_config_file) {
     cfg_t *config = cfg_init(opts, CFGF_NONE);
     cfg_set_validate_func(config, "task|time", config_validate_time);
+    cfg_set_validate_func(config, "task|prewarm", config_validate_time);
+    cfg_set_validate_func(config, "task|every", config_validate_time);
+    cfg_set_validate_func(config, "task|until", config_validate_time);
     cfg_set_validate_func(config, "task", config_validate_task);
+    cfg_set_validate_func(config, "task|log_size", config_validate_log_size);
+    cfg_set_validate_func(config, "task|cpu_weight",
+            config_validate_cpu_weight);
+    cfg_set_validate_func(config, "task|memory_max",
+            config_validate_memory_max);
+    cfg_set_validate_func(config, "task|power", config_validate_power);
+    cfg_set_validate_func(config, "task|nice", config_validate_nice);
+    cfg_set_validate_func(config, "inhibit|days", config_validate_days);
+    cfg_set_validate_func(config, "inhibit|from", config_validate_clock);
+    cfg_set_validate_func(config, "inhibit|until", config_validate_clock);
+    cfg_set_validate_func(config, "poll_max", config_validate_duration);
+    cfg_set_validate_func(config, "cycle_budget", config_validate_duration);
+    cfg_set_validate_func(config, "sched_policy", config_validate_sched_policy);
+    cfg_set_validate_func(config, "sched_priority",
+            config_validate_sched_priority);
+    cfg_set_validate_func(config, "nice", config_validate_nice);
 
     char *config_file = get_config_path(const_config_file);
     if(*config_file == '\0') {
@@ -66,21 +131,90 @@ cfg_t *read_config(const char *const_config_file) {
         die("Failed to parse configuration file.\n");
     }
     free(config_file);
+
+    // options can't be validated against each other as they are parsed
+    int policy;
+    priority_parse_policy(cfg_getstr(config, "sched_policy"), &policy);
+    if((policy == SCHED_FIFO || policy == SCHED_RR) &&
+            cfg_getint(config, "nice") != INT_MIN)
+        die("nice cannot be used with sched_policy %s.\n",
+                cfg_getstr(config, "sched_policy"));
     return config;
 }
 
 unsigned get_tasks(cfg_t *config, struct Task **tasks_ptr) {
     unsigned n = cfg_size(config, "task");
-    *tasks_ptr = calloc(n, sizeof(struct Task));
+
+    // tasks and their strings are put in one block
+    size_t size = n * sizeof(struct Task);
     for(unsigned i = 0; i < n; i++) {
         cfg_t *task = cfg_getnsec(config, "task", i);
-        (*tasks_ptr)[i].name = cfg_title(task);
+        size += strlen(cfg_title(task)) + 1;
+        size += strlen(cfg_getstr(task, "command")) + 1;
+        if(cfg_getstr(task, "log_file"))
+            size += strlen(cfg_getstr(task, "log_file")) + 1;
+        if(cfg_getstr(task, "memory_max"))
+            size += strlen(cfg_getstr(task, "memory_max")) + 1;
+    }
+    *tasks_ptr = calloc(1, size);
+    if(!*tasks_ptr)
+        die_perror("calloc");
+    char *strings = (char *) (*tasks_ptr + n);
+
+    for(unsigned i = 0; i < n; i++) {
+        cfg_t *task = cfg_getnsec(config, "task", i);
+        (*tasks_ptr)[i].name = arena_strcpy(&strings, cfg_title(task));
         parse_time(cfg_getstr(task, "time"), &(*tasks_ptr)[i].time);
-        (*tasks_ptr)[i].command = cfg_getstr(task, "command");
+        (*tasks_ptr)[i].step = (*tasks_ptr)[i].time;
+        if(cfg_getstr(task, "every"))
+            parse_time(cfg_getstr(task, "every"), &(*tasks_ptr)[i].every);
+        if(cfg_getstr(task, "until"))
+            parse_time(cfg_getstr(task, "until"), &(*tasks_ptr)[i].until);
+        (*tasks_ptr)[i].command =
+            arena_strcpy(&strings, cfg_getstr(task, "command"));
+        (*tasks_ptr)[i].log.size = cfg_getint(task, "log_size");
+        (*tasks_ptr)[i].log_file =
+            arena_strcpy(&strings, cfg_getstr(task, "log_file"));
+        (*tasks_ptr)[i].outfd = -1;
+        (*tasks_ptr)[i].logfd = -1;
+        if(cfg_getstr(task, "prewarm"))
+            parse_time(cfg_getstr(task, "prewarm"), &(*tasks_ptr)[i].prewarm);
+        (*tasks_ptr)[i].warm_fd = -1;
+        // a limit implies a cgroup
+        (*tasks_ptr)[i].cpu_weight = cfg_getint(task, "cpu_weight");
+        (*tasks_ptr)[i].memory_max =
+            arena_strcpy(&strings, cfg_getstr(task, "memory_max"));
+        (*tasks_ptr)[i].cgroup = cfg_getbool(task, "cgroup") ||
+            (*tasks_ptr)[i].cpu_weight || (*tasks_ptr)[i].memory_max;
+        (*tasks_ptr)[i].cgroupfd = -1;
+        (*tasks_ptr)[i].cpu_usec = (*tasks_ptr)[i].mem_peak = -1;
+        power_parse(cfg_getstr(task, "power"), &(*tasks_ptr)[i].power);
+        (*tasks_ptr)[i].nice = cfg_getint(task, "nice");
+    }
+    return n;
+}
+
+unsigned get_inhibits(cfg_t *config, struct Inhibit **inhibits_ptr) {
+    unsigned n = cfg_size(config, "inhibit");
+    *inhibits_ptr = calloc(n, sizeof(struct Inhibit));
+    for(unsigned i = 0; i < n; i++) {
+        cfg_t *inhibit = cfg_getnsec(config, "inhibit", i);
+        parse_days(cfg_getstr(inhibit, "days"), &(*inhibits_ptr)[i].days);
+        parse_clock(cfg_getstr(inhibit, "from"), &(*inhibits_ptr)[i].from);
+        parse_clock(cfg_getstr(inhibit, "until"), &(*inhibits_ptr)[i].until);
     }
     return n;
 }
 
+// copy s (if not NULL) to *arena and advance *arena past it
+static const char *arena_strcpy(char **arena, const char *s) {
+    if(!s)
+        return NULL;
+    char *t = *arena;
+    *arena = stpcpy(t, s) + 1;
+    return t;
+}
+
 // if const_config_path is not NULL, return a freeable copy
 // otherwise return default configuration path
 static char *get_config_path(const char *const_config_path) {
@@ -90,7 +224,7 @@ static char *get_config_path(const char *const_config_path) {
 }
 
 // parse time duration of format \(\d+\(d\|h\|m\|s\|ms\|ns\)\)+
-static int parse_time(const char *s, struct timespec *t) {
+int parse_time(const char *s, struct timespec *t) {
     if(!*s)
         return -1;
     t->tv_sec = t->tv_nsec = 0;
@@ -143,6 +277,65 @@ static int parse_time(const char *s, struct timespec *t) {
     return 0;
 }
 
+// parse weekdays of format \(day\(-day\)\?\)\(,day\(-day\)\?\)*
+// where day is one of sun, mon, ..., sat
+int parse_days(const char *s, unsigned *days) {
+    *days = 0;
+    while(true) {
+        int range[2];
+        for(int k = 0; k < 2; k++) {
+            range[k] = -1;
+            for(int d = 0; d < 7; d++)
+                if(strncmp(s, weekdays[d], 3) == 0)
+                    range[k] = d;
+            if(range[k] < 0)
+                return -1;
+            s += 3;
+            if(k == 0) {
+                if(*s != '-') {
+                    range[1] = range[0];
+                    break;
+                }
+                s++;
+            }
+        }
+        // ranges may wrap around, e.g. fri-mon
+        for(int d = range[0]; ; d = (d + 1) % 7) {
+            *days |= 1u << d;
+            if(d == range[1])
+                break;
+        }
+        if(!*s)
+            return 0;
+        if(*s++ != ',')
+            return -1;
+    }
+}
+
+// parse time of day of format \d\d\?:\d\d\(:\d\d\)\?, up to 24:00
+int parse_clock(const char *s, int *sec) {
+    // hours, minutes and seconds; only hours may have one digit
+    int field[3] = {0, 0, 0}, n = 0;
+    while(true) {
+        int digits = 0;
+        for(; digits < 2 && *s >= '0' && *s <= '9'; digits++)
+            field[n] = field[n] * 10 + *s++ - '0';
+        if(digits == 0 || (n > 0 && digits < 2))
+            return -1;
+        n++;
+        if(!*s)
+            break;
+        if(n == 3 || *s++ != ':')
+            return -1;
+    }
+    if(n < 2 || field[1] > 59 || field[2] > 59)
+        return -1;
+    *sec = field[0] * 3600 + field[1] * 60 + field[2];
+    if(*sec > 86400)
+        return -1;
+    return 0;
+}
+
 // validate the time option (must be positive)
 static int config_validate_time(cfg_t *cfg, cfg_opt_t *opt) {
     const char *s = cfg_opt_getnstr(opt, 0);
@@ -161,13 +354,137 @@ static int config_validate_time(cfg_t *cfg, cfg_opt_t *opt) {
     }
     return 0;
 }
-// validate the task section (command option required)
+// validate an option that may be zero (but not negative)
+static int config_validate_duration(cfg_t *cfg, cfg_opt_t *opt) {
+    struct timespec t;
+    if(parse_time(cfg_opt_getnstr(opt, 0), &t) < 0) {
+        cfg_error(cfg, "bad time format");
+        return -1;
+    }
+    if(t.tv_sec < 0) {
+        cfg_error(cfg, "negative time");
+        return -1;
+    }
+    return 0;
+}
+// validate the task section (command option required,
+// prewarm must be shorter than time and every,
+// until requires every and must not be before time)
 static int config_validate_task(cfg_t *cfg, cfg_opt_t *opt) {
     cfg_t *task = cfg_opt_getnsec(opt, cfg_opt_size(opt) - 1);
     if (cfg_size(task, "command") == 0) {
         cfg_error(cfg, "missing required option 'command' in task");
         return -1;
     }
+    struct timespec time, prewarm, every, until;
+    parse_time(cfg_getstr(task, "time"), &time);
+    if(cfg_getstr(task, "prewarm")) {
+        parse_time(cfg_getstr(task, "prewarm"), &prewarm);
+        if(timespec_cmp(prewarm, time) >= 0) {
+            cfg_error(cfg, "prewarm must be shorter than time");
+            return -1;
+        }
+        if(cfg_getstr(task, "every")) {
+            parse_time(cfg_getstr(task, "every"), &every);
+            if(timespec_cmp(prewarm, every) >= 0) {
+                cfg_error(cfg, "prewarm must be shorter than every");
+                return -1;
+            }
+        }
+    }
+    if(cfg_getstr(task, "until")) {
+        if(!cfg_getstr(task, "every")) {
+            cfg_error(cfg, "until is meaningless without every");
+            return -1;
+        }
+        parse_time(cfg_getstr(task, "until"), &until);
+        if(timespec_cmp(until, time) < 0) {
+            cfg_error(cfg, "until must not be before time");
+            return -1;
+        }
+    }
+    return 0;
+}
+// validate the log_size option (at most 64KiB, so it fits in a response)
+static int config_validate_log_size(cfg_t *cfg, cfg_opt_t *opt) {
+    long size = cfg_opt_getnint(opt, 0);
+    if(size < 0 || size > 65536) {
+        cfg_error(cfg, "log_size must be between 0 and 65536");
+        return -1;
+    }
+    return 0;
+}
+// validate the cpu_weight option (0 for the default of the kernel)
+static int config_validate_cpu_weight(cfg_t *cfg, cfg_opt_t *opt) {
+    long weight = cfg_opt_getnint(opt, 0);
+    if(weight < 0 || weight > 10000) {
+        cfg_error(cfg, "cpu_weight must be between 1 and 10000");
+        return -1;
+    }
+    return 0;
+}
+// validate the memory_max option ("max", or bytes with K, M, G or T suffix)
+static int config_validate_memory_max(cfg_t *cfg, cfg_opt_t *opt) {
+    const char *s = cfg_opt_getnstr(opt, 0);
+    size_t digits = strspn(s, "0123456789");
+    if(strcmp(s, "max") != 0 && (digits == 0 ||
+                (s[digits] && (!strchr("KMGT", s[digits]) || s[digits + 1])))) {
+        cfg_error(cfg, "bad memory_max format");
+        return -1;
+    }
+    return 0;
+}
+// validate the power option
+static int config_validate_power(cfg_t *cfg, cfg_opt_t *opt) {
+    enum PowerSource source;
+    if(power_parse(cfg_opt_getnstr(opt, 0), &source) < 0) {
+        cfg_error(cfg, "power must be any, ac or battery");
+        return -1;
+    }
+    return 0;
+}
+// validate the nice options
+static int config_validate_nice(cfg_t *cfg, cfg_opt_t *opt) {
+    long nice = cfg_opt_getnint(opt, 0);
+    if(nice < -20 || nice > 19) {
+        cfg_error(cfg, "nice must be between -20 and 19");
+        return -1;
+    }
+    return 0;
+}
+// validate the sched_policy option
+static int config_validate_sched_policy(cfg_t *cfg, cfg_opt_t *opt) {
+    int policy;
+    if(priority_parse_policy(cfg_opt_getnstr(opt, 0), &policy) < 0) {
+        cfg_error(cfg, "sched_policy must be other, batch, idle, fifo or rr");
+        return -1;
+    }
+    return 0;
+}
+// validate the sched_priority option
+static int config_validate_sched_priority(cfg_t *cfg, cfg_opt_t *opt) {
+    long priority = cfg_opt_getnint(opt, 0);
+    if(priority < 1 || priority > 99) {
+        cfg_error(cfg, "sched_priority must be between 1 and 99");
+        return -1;
+    }
+    return 0;
+}
+// validate the days option
+static int config_validate_days(cfg_t *cfg, cfg_opt_t *opt) {
+    unsigned days;
+    if(parse_days(cfg_opt_getnstr(opt, 0), &days) < 0) {
+        cfg_error(cfg, "bad weekday format");
+        return -1;
+    }
+    return 0;
+}
+// validate the from and until options
+static int config_validate_clock(cfg_t *cfg, cfg_opt_t *opt) {
+    int sec;
+    if(parse_clock(cfg_opt_getnstr(opt, 0), &sec) < 0) {
+        cfg_error(cfg, "bad time of day format");
+        return -1;
+    }
     return 0;
 }
-
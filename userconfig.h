@@ -20,6 +20,8 @@
 #define JAUTOLOCK_USERCONFIG_H
 #include <confuse.h>
 struct Task;
+struct Inhibit;
+struct timespec;
 /**
  * Read the specfied configuration file.
  * Search for one if config_file is NULL.
@@ -29,6 +31,32 @@ cfg_t *read_config(const char *config_file);
  * Get a list of tasks from config.
  * Returns the number of tasks.
  * The list of tasks is put in *tasks_ptr.
+ *
+ * The list does not refer to config, and is freed with one free().
  */
 unsigned get_tasks(cfg_t *config, struct Task **tasks_ptr);
+/**
+ * Get a list of inhibit windows from config.
+ * Returns the number of windows.
+ * The list of windows is put in *inhibits_ptr.
+ */
+unsigned get_inhibits(cfg_t *config, struct Inhibit **inhibits_ptr);
+/**
+ * Parse time duration of format \(\d+\(d\|h\|m\|s\|ms\|ns\)\)+
+ * Returns 0 on success and -1 on failure.
+ */
+int parse_time(const char *s, struct timespec *t);
+/**
+ * Parse weekdays of format \(day\(-day\)\?\)\(,day\(-day\)\?\)*
+ * where day is one of sun, mon, ..., sat, and a range may wrap around.
+ * The days are put in *days as a bitmask (bit 0 is Sunday).
+ * Returns 0 on success and -1 on failure.
+ */
+int parse_days(const char *s, unsigned *days);
+/**
+ * Parse time of day of format \d\d\?:\d\d\(:\d\d\)\?, up to 24:00
+ * The seconds since midnight are put in *sec.
+ * Returns 0 on success and -1 on failure.
+ */
+int parse_clock(const char *s, int *sec);
 #endif // JAUTOLOCK_USERCONFIG_H
@@ -0,0 +1,194 @@
+/*
+ * watchdog.c - notice when the main loop gets stuck
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "watchdog.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "die.h"
+#include "priority.h"
+#include "timespec.h"
+#include "trace.h"
+
+static void *watchdog_main(void *arg);
+static bool check_stall(uint64_t now);
+static int notify_socket(void);
+
+static const char *const phase_names[] = {
+    [WATCH_WAIT] = "wait",
+    [WATCH_CYCLE] = "cycle",
+    [WATCH_IDLE] = "idle",
+    [WATCH_FIRE] = "fire",
+    [WATCH_OUTPUT] = "output",
+    [WATCH_REAP] = "reap",
+    [WATCH_MESSAGE] = "message",
+    [WATCH_POWER] = "power",
+};
+
+// the thread only sleeps, checks and sends a datagram
+static const size_t stack_size = 65536;
+
+// written by the main thread: when the current pass started,
+// then its phase (so a phase read implies a start at least as new)
+static atomic_uint_fast64_t pass_start;
+static atomic_int pass_phase;
+static atomic_ullong stalls;
+
+// set before the watchdog thread starts
+static uint64_t budget_ns, ping_ns;
+// how long a pass may take before no ping is sent
+static uint64_t stall_ns;
+static int notify_fd = -1;
+static struct sockaddr_un notify_addr;
+static socklen_t notify_len;
+// only touched by the watchdog thread
+// start of the pass last reported as stuck
+static uint64_t reported;
+
+void watchdog_start(struct timespec budget) {
+    budget_ns = (uint64_t) budget.tv_sec * 1000000000 + budget.tv_nsec;
+    const char *usec = getenv("WATCHDOG_USEC");
+    const char *pid = getenv("WATCHDOG_PID");
+    if(usec && getenv("NOTIFY_SOCKET") && (!pid || atol(pid) == getpid()))
+        ping_ns = strtoull(usec, NULL, 10) * 1000 / 2;
+    if(ping_ns)
+        notify_fd = notify_socket();
+    if(!budget_ns && notify_fd < 0)
+        return;
+    // without a budget, a pass missing a ping is too long
+    stall_ns = budget_ns ? budget_ns : ping_ns;
+
+    pthread_attr_t attr;
+    int err = pthread_attr_init(&attr);
+    if(!err)
+        err = pthread_attr_setstacksize(&attr, stack_size);
+    if(!err)
+        err = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if(err) {
+        errno = err;
+        die_perror("pthread_attr_setstacksize");
+    }
+
+    // signals are for the scheduler thread only
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t thread;
+    err = pthread_create(&thread, &attr, watchdog_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+    if(err) {
+        errno = err;
+        die_perror("pthread_create");
+    }
+}
+
+void watch_beat(void) {
+    atomic_store_explicit(&pass_start, now_ns(), memory_order_relaxed);
+    atomic_store_explicit(&pass_phase, WATCH_CYCLE, memory_order_release);
+}
+
+enum WatchPhase watch_phase(enum WatchPhase phase) {
+    return atomic_exchange_explicit(&pass_phase, phase, memory_order_release);
+}
+
+unsigned long long watchdog_stalls(void) {
+    return atomic_load_explicit(&stalls, memory_order_relaxed);
+}
+
+static void *watchdog_main(void *arg) {
+    (void) arg;
+    // not inherited, see priority.h
+    priority_apply_thread();
+    // check often enough to notice a stall within 1.5 budgets
+    uint64_t period = budget_ns / 2;
+    if(!period || (notify_fd >= 0 && ping_ns < period))
+        period = ping_ns;
+    uint64_t next_ping = 0;
+    while(true) {
+        struct timespec t = {period / 1000000000, period % 1000000000};
+        while(clock_nanosleep(CLOCK_MONOTONIC, 0, &t, &t) == EINTR)
+            continue;
+
+        uint64_t now = now_ns();
+        bool stuck = check_stall(now);
+        if(notify_fd >= 0 && !stuck && now >= next_ping) {
+            // the supervisor may not be there yet or any more
+            sendto(notify_fd, "WATCHDOG=1", 10, MSG_NOSIGNAL,
+                    (const struct sockaddr *) &notify_addr, notify_len);
+            next_ping = now + ping_ns;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Whether the main loop has been in the current pass for too long.
+ * Reports it the first time.
+ */
+static bool check_stall(uint64_t now) {
+    int phase = atomic_load_explicit(&pass_phase, memory_order_acquire);
+    uint64_t start = atomic_load_explicit(&pass_start, memory_order_relaxed);
+    if(phase == WATCH_WAIT || now - start <= stall_ns)
+        return false;
+    if(start != reported) {
+        reported = start;
+        atomic_fetch_add_explicit(&stalls, 1, memory_order_relaxed);
+        trace(TRACE_STALL, phase);
+        fprintf(stderr, "WARNING: main loop stuck in %s for %llu ms\n",
+                phase_names[phase],
+                (unsigned long long) ((now - start) / 1000000));
+    }
+    return true;
+}
+
+/**
+ * Open a socket to send notifications to $NOTIFY_SOCKET
+ * (a path, or an abstract address starting with '@').
+ * Returns -1 with a warning if that is not possible.
+ */
+static int notify_socket(void) {
+    const char *path = getenv("NOTIFY_SOCKET");
+    size_t n = strlen(path);
+    if((path[0] != '/' && path[0] != '@') ||
+            n >= sizeof(notify_addr.sun_path)) {
+        fprintf(stderr, "WARNING: unsupported NOTIFY_SOCKET %s\n", path);
+        return -1;
+    }
+    notify_addr.sun_family = AF_UNIX;
+    memcpy(notify_addr.sun_path, path, n);
+    if(path[0] == '@')
+        notify_addr.sun_path[0] = '\0';
+    notify_len = offsetof(struct sockaddr_un, sun_path) + n;
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        fprintf(stderr, "WARNING: cannot open notify socket: %s\n",
+                strerror(errno));
+    return fd;
+}
@@ -0,0 +1,60 @@
+/*
+ * watchdog.h - notice when the main loop gets stuck
+ *
+ * Copyright (C) 2017 Pochang Chen
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef JAUTOLOCK_WATCHDOG_H
+#define JAUTOLOCK_WATCHDOG_H
+#include <time.h>
+/**
+ * What the main loop is doing.
+ * Only time spent outside WATCH_WAIT counts towards the budget.
+ */
+enum WatchPhase {
+    WATCH_WAIT,     // waiting for events
+    WATCH_CYCLE,    // timecalc_cycle() otherwise
+    WATCH_IDLE,     // querying X for the idle time
+    WATCH_FIRE,     // starting or prewarming a task
+    WATCH_OUTPUT,   // draining output of tasks
+    WATCH_REAP,     // reaping tasks
+    WATCH_MESSAGE,  // handling messages (including reexec)
+    WATCH_POWER,    // reading the power supplies
+};
+/**
+ * Start the watchdog thread if needed, that is, if budget is not zero
+ * or a supervisor asks for keep-alive pings (sd_notify WATCHDOG=1,
+ * through $NOTIFY_SOCKET every half of $WATCHDOG_USEC).
+ *
+ * A pass of the main loop taking longer than budget (or if budget is
+ * zero, than the interval of the pings) is reported (once per pass)
+ * on stderr and as a TRACE_STALL event.
+ * No ping is sent while the main loop is stuck like that.
+ */
+void watchdog_start(struct timespec budget);
+/**
+ * Mark the start of a pass of the main loop, in phase WATCH_CYCLE.
+ */
+void watch_beat(void);
+/**
+ * Set the phase of the current pass.
+ * Returns the previous phase, to be set back afterwards.
+ */
+enum WatchPhase watch_phase(enum WatchPhase phase);
+/**
+ * Returns the number of stalls reported so far.
+ */
+unsigned long long watchdog_stalls(void);
+#endif // JAUTOLOCK_WATCHDOG_H